@@ -0,0 +1,366 @@
+// Google Benchmark suite for RosterManager. Build from the repository root:
+//
+//     g++ -std=c++20 -O2 -pthread bench/roster_bench.cpp -lbenchmark -o roster_bench
+//
+// Extra flags on top of the usual --benchmark_* ones:
+//     --save-baseline=FILE   write the results as the new baseline
+//     --baseline=FILE        print each result's change against FILE
+#define ROSTER_NO_MAIN
+#include "../system.cpp"
+#undef ROSTER_NO_MAIN
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <map>
+
+namespace
+{
+
+// Deterministic roster: the same size, group count, skew and seed always
+// give the same file. With skew 0 the groups are uniform; larger values
+// pile students into the low-numbered groups (group = groups * u^(1+skew)).
+struct SyntheticRoster
+{
+    std::size_t students = 1000;
+    std::size_t groups = 10;
+    double skew = 0.0;
+    std::uint64_t seed = 1;
+
+    std::string csv() const
+    {
+        Xoshiro256StarStar rng(seed);
+        std::string text;
+        text.reserve(students * 24);
+        for (std::size_t i = 0; i < students; ++i)
+        {
+            const auto u = static_cast<double>(rng() >> 11) * 0x1.0p-53;
+            const auto group = std::min(groups - 1, static_cast<std::size_t>(groups * std::pow(u, 1.0 + skew)));
+            text.append("Student").append(std::to_string(i));
+            text.append(",Group").append(std::to_string(group)).push_back('\n');
+        }
+        return text;
+    }
+
+    // Written once per configuration under the temp directory.
+    std::string path() const
+    {
+        const auto file = std::filesystem::temp_directory_path() /
+                          ("roster_bench_" + std::to_string(students) + "_" + std::to_string(groups) + "_" +
+                           std::to_string(static_cast<int>(skew * 100)) + "_" + std::to_string(seed) + ".csv");
+        if (!std::filesystem::exists(file))
+        {
+            writeFileAtomically(file.string(), csv());
+        }
+        return file.string();
+    }
+
+    // About sqrt(n) groups, which keeps group sizes realistic at every scale.
+    static SyntheticRoster ofSize(std::int64_t n, double skew = 0.0)
+    {
+        SyntheticRoster roster;
+        roster.students = static_cast<std::size_t>(n);
+        roster.groups = std::max<std::size_t>(1, static_cast<std::size_t>(std::sqrt(static_cast<double>(n))));
+        roster.skew = skew;
+        return roster;
+    }
+};
+
+// Managers are reused across benchmarks of the same size; the retention cap
+// keeps long pick loops from growing the history without bound.
+template <typename Manager = RosterManager>
+Manager &loadedManager(std::int64_t n)
+{
+    static std::map<std::int64_t, std::unique_ptr<Manager>> managers;
+    auto &manager = managers[n];
+    if (!manager)
+    {
+        manager = std::make_unique<Manager>(std::uint64_t{42});
+        manager->importFromFile(SyntheticRoster::ofSize(n).path());
+        manager->setHistoryRetention(1 << 16);
+    }
+    return *manager;
+}
+
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override
+    {
+        return c;
+    }
+
+    std::streamsize xsputn(const char *, std::streamsize count) override
+    {
+        return count;
+    }
+};
+
+void setSizes(benchmark::internal::Benchmark *bench, std::int64_t largest)
+{
+    bench->RangeMultiplier(10)->Range(100, largest);
+}
+
+void BM_Import(benchmark::State &state)
+{
+    const auto path = SyntheticRoster::ofSize(state.range(0)).path();
+    for (auto _ : state)
+    {
+        RosterManager manager(std::uint64_t{1});
+        benchmark::DoNotOptimize(manager.importFromFile(path));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Import)->Apply([](auto *b) { setSizes(b, 10'000'000); })->Unit(benchmark::kMillisecond);
+
+void BM_ImportSkewed(benchmark::State &state)
+{
+    const auto path = SyntheticRoster::ofSize(state.range(0), 2.0).path();
+    for (auto _ : state)
+    {
+        RosterManager manager(std::uint64_t{1});
+        benchmark::DoNotOptimize(manager.importFromFile(path));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ImportSkewed)->Apply([](auto *b) { setSizes(b, 1'000'000); })->Unit(benchmark::kMillisecond);
+
+void BM_PickIndex(benchmark::State &state)
+{
+    auto &manager = loadedManager(state.range(0));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(manager.pickIndex());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PickIndex)->Apply([](auto *b) { setSizes(b, 10'000'000); });
+
+// Same picks without locks, history or clock reads.
+void BM_PickIndexKiosk(benchmark::State &state)
+{
+    auto &manager = loadedManager<KioskRosterManager>(state.range(0));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(manager.pickIndex());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PickIndexKiosk)->Apply([](auto *b) { setSizes(b, 10'000'000); });
+
+void BM_PickGroup(benchmark::State &state)
+{
+    auto &manager = loadedManager(state.range(0));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(manager.pickIndex("Group0"));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PickGroup)->Apply([](auto *b) { setSizes(b, 10'000'000); });
+
+void BM_PickBatch(benchmark::State &state)
+{
+    auto &manager = loadedManager(state.range(0));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(manager.pickBatch(64));
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+BENCHMARK(BM_PickBatch)->Apply([](auto *b) { setSizes(b, 10'000'000); });
+
+// A whole cycle per iteration: every student once, then the restart.
+void BM_FullCycle(benchmark::State &state)
+{
+    auto &manager = loadedManager(state.range(0));
+    const auto n = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state)
+    {
+        manager.resetCycle();
+        benchmark::DoNotOptimize(manager.pickBatch(n));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FullCycle)->Apply([](auto *b) { setSizes(b, 1'000'000); })->Unit(benchmark::kMicrosecond);
+
+template <typename Manager>
+void historyAppend(benchmark::State &state)
+{
+    Manager manager(std::uint64_t{3});
+    manager.importFromFile(SyntheticRoster::ofSize(1000).path());
+    const auto records = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        manager.clearHistory();
+        state.ResumeTiming();
+        for (std::size_t done = 0; done < records; done += 1000)
+        {
+            manager.pickBatch(std::min<std::size_t>(1000, records - done));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["history_bytes"] = static_cast<double>(manager.metricsReport().historyBytes);
+}
+
+void BM_HistoryAppend(benchmark::State &state)
+{
+    historyAppend<RosterManager>(state);
+}
+BENCHMARK(BM_HistoryAppend)->Apply([](auto *b) { setSizes(b, 10'000'000); })->Unit(benchmark::kMicrosecond);
+
+// Coarse clock and 12-byte records.
+void BM_HistoryAppendCompact(benchmark::State &state)
+{
+    historyAppend<CompactRosterManager>(state);
+}
+BENCHMARK(BM_HistoryAppendCompact)->Apply([](auto *b) { setSizes(b, 10'000'000); })->Unit(benchmark::kMicrosecond);
+
+void BM_HistoryIterate(benchmark::State &state)
+{
+    RosterManager manager(std::uint64_t{3});
+    manager.importFromFile(SyntheticRoster::ofSize(1000).path());
+    for (std::int64_t done = 0; done < state.range(0); done += 1000)
+    {
+        manager.pickBatch(static_cast<std::size_t>(std::min<std::int64_t>(1000, state.range(0) - done)));
+    }
+    for (auto _ : state)
+    {
+        std::size_t groups = 0;
+        manager.forEachRecent(0, [&groups](const RosterManager::CallRecord &record) { groups += record.groupId; });
+        benchmark::DoNotOptimize(groups);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_HistoryIterate)->Apply([](auto *b) { setSizes(b, 10'000'000); })->Unit(benchmark::kMicrosecond);
+
+void BM_PrintStats(benchmark::State &state)
+{
+    auto &manager = loadedManager(state.range(0));
+    NullBuffer sink;
+    auto *const original = std::cout.rdbuf(&sink);
+    for (auto _ : state)
+    {
+        manager.printStats();
+    }
+    std::cout.rdbuf(original);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PrintStats)->Apply([](auto *b) { setSizes(b, 1'000'000); })->Unit(benchmark::kMicrosecond);
+
+void BM_TopCalled(benchmark::State &state)
+{
+    auto &manager = loadedManager(state.range(0));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(manager.topCalled(10));
+    }
+}
+BENCHMARK(BM_TopCalled)->Apply([](auto *b) { setSizes(b, 10'000'000); });
+
+// Console output plus, per run, the change against a saved baseline.
+// Baseline files hold one "name<TAB>nanoseconds per iteration" line per run.
+class BaselineReporter : public benchmark::ConsoleReporter
+{
+public:
+    BaselineReporter(std::map<std::string, double> baseline, std::string savePath)
+        : baseline_(std::move(baseline)), savePath_(std::move(savePath))
+    {
+    }
+
+    void ReportRuns(const std::vector<Run> &runs) override
+    {
+        ConsoleReporter::ReportRuns(runs);
+        for (const auto &run : runs)
+        {
+            if (run.run_type != Run::RT_Iteration || !run.iterations)
+            {
+                continue;
+            }
+            const auto name = run.benchmark_name();
+            const auto nanoseconds = run.real_accumulated_time * 1e9 / static_cast<double>(run.iterations);
+            results_.emplace_back(name, nanoseconds);
+            if (const auto it = baseline_.find(name); it != baseline_.end() && it->second > 0)
+            {
+                const auto change = (nanoseconds / it->second - 1.0) * 100.0;
+                GetOutputStream() << "    vs baseline: " << (change >= 0 ? "+" : "") << change << "%\n";
+            }
+        }
+    }
+
+    void Finalize() override
+    {
+        ConsoleReporter::Finalize();
+        if (savePath_.empty())
+        {
+            return;
+        }
+        std::string text;
+        for (const auto &[name, nanoseconds] : results_)
+        {
+            text.append(name).append("\t").append(std::to_string(nanoseconds)).push_back('\n');
+        }
+        if (!writeFileAtomically(savePath_, text))
+        {
+            GetErrorStream() << "Failed to write baseline " << savePath_ << '\n';
+        }
+    }
+
+    static std::map<std::string, double> load(const std::string &path)
+    {
+        std::map<std::string, double> baseline;
+        std::ifstream input(path);
+        std::string line;
+        while (std::getline(input, line))
+        {
+            const auto tab = line.rfind('\t');
+            if (tab != std::string::npos)
+            {
+                baseline[line.substr(0, tab)] = std::strtod(line.c_str() + tab + 1, nullptr);
+            }
+        }
+        return baseline;
+    }
+
+private:
+    std::map<std::string, double> baseline_;
+    std::string savePath_;
+    std::vector<std::pair<std::string, double>> results_;
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string baselinePath;
+    std::string savePath;
+    std::vector<char *> args;
+    for (int i = 0; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg.starts_with("--baseline="))
+        {
+            baselinePath = arg.substr(11);
+        }
+        else if (arg.starts_with("--save-baseline="))
+        {
+            savePath = arg.substr(16);
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+    auto count = static_cast<int>(args.size());
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+    {
+        return 1;
+    }
+    BaselineReporter reporter(baselinePath.empty() ? std::map<std::string, double>{} : BaselineReporter::load(baselinePath),
+                              savePath);
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+    return 0;
+}
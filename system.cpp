@@ -1,305 +1,7060 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <coroutine>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <deque>
 #include <fstream>
-#include <iomanip>
+#include <functional>
 #include <iostream>
 #include <limits>
-#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <numeric>
 #include <optional>
 #include <random>
+#include <ranges>
+#include <set>
+#include <shared_mutex>
+#include <span>
+#include <sstream>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
-class RosterManager
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Returns the first occurrence of `c` in [first, last), or `last`.
+inline const char *findByte(const char *first, const char *last, char c)
+{
+#if defined(__AVX2__)
+    const auto wide = _mm256_set1_epi8(c);
+    for (; last - first >= 32; first += 32)
+    {
+        const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, wide)));
+        if (mask)
+        {
+            return first + __builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const auto narrow = _mm_set1_epi8(c);
+    for (; last - first >= 16; first += 16)
+    {
+        const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        const auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, narrow)));
+        if (mask)
+        {
+            return first + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; first != last; ++first)
+    {
+        if (*first == c)
+        {
+            return first;
+        }
+    }
+    return last;
+}
+
+// Read-only view of a whole file: memory-mapped where available, read into
+// an owned buffer everywhere else and for pipes, terminals and other files
+// whose size is not known up front.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat info{};
+        const bool statted = ::fstat(fd, &info) == 0;
+        if (statted && !S_ISREG(info.st_mode))
+        {
+            open_ = readAll(fd);
+        }
+        else if (statted)
+        {
+            open_ = true;
+            size_ = static_cast<std::size_t>(info.st_size);
+            if (size_)
+            {
+                void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED)
+                {
+                    open_ = false;
+                    size_ = 0;
+                }
+                else
+                {
+                    ::madvise(data, size_, MADV_SEQUENTIAL);
+                    mapping_ = static_cast<const char *>(data);
+                }
+            }
+        }
+        ::close(fd);
+#else
+        std::ifstream input(path, std::ios::binary);
+        if (!input.is_open())
+        {
+            return;
+        }
+        open_ = true;
+        buffer_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        size_ = buffer_.size();
+#endif
+    }
+
+    ~MappedFile()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (mapping_)
+        {
+            ::munmap(const_cast<char *>(mapping_), size_);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool isOpen() const
+    {
+        return open_;
+    }
+
+    std::string_view view() const
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (mapping_)
+        {
+            return {mapping_, size_};
+        }
+#endif
+        return buffer_;
+    }
+
+private:
+#if defined(__unix__) || defined(__APPLE__)
+    bool readAll(int fd)
+    {
+        std::array<char, 64 * 1024> chunk;
+        while (true)
+        {
+            const auto n = ::read(fd, chunk.data(), chunk.size());
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                size_ = buffer_.size();
+                return n == 0;
+            }
+            buffer_.append(chunk.data(), static_cast<std::size_t>(n));
+        }
+    }
+#endif
+
+    bool open_ = false;
+    std::size_t size_ = 0;
+#if defined(__unix__) || defined(__APPLE__)
+    const char *mapping_ = nullptr;
+#endif
+    std::string buffer_;
+};
+
+// Running 64-bit hash of a byte stream, fed in pieces of any size; value()
+// can be read at any point without ending the stream. Used to check that a
+// file still starts with what was read from it last time, not for tables.
+class ContentHash
+{
+public:
+    void update(std::string_view bytes)
+    {
+        length_ += bytes.size();
+        if (pendingSize_)
+        {
+            const auto take = std::min(bytes.size(), pending_.size() - pendingSize_);
+            std::memcpy(pending_.data() + pendingSize_, bytes.data(), take);
+            pendingSize_ += take;
+            bytes.remove_prefix(take);
+            if (pendingSize_ < pending_.size())
+            {
+                return;
+            }
+            state_ = mix(state_, load(pending_.data()));
+            pendingSize_ = 0;
+        }
+        for (; bytes.size() >= sizeof(std::uint64_t); bytes.remove_prefix(sizeof(std::uint64_t)))
+        {
+            state_ = mix(state_, load(bytes.data()));
+        }
+        std::memcpy(pending_.data(), bytes.data(), bytes.size());
+        pendingSize_ = bytes.size();
+    }
+
+    std::uint64_t value() const
+    {
+        std::array<char, sizeof(std::uint64_t)> tail{};
+        std::memcpy(tail.data(), pending_.data(), pendingSize_);
+        auto hash = mix(state_, load(tail.data())) ^ length_;
+        hash = (hash ^ (hash >> 33)) * 0xff51afd7ed558ccdULL;
+        hash = (hash ^ (hash >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        return hash ^ (hash >> 33);
+    }
+
+private:
+    static std::uint64_t load(const char *bytes)
+    {
+        std::uint64_t word = 0;
+        std::memcpy(&word, bytes, sizeof(word));
+        return word;
+    }
+
+    static std::uint64_t mix(std::uint64_t state, std::uint64_t word)
+    {
+        return std::rotl((state ^ word) * 0x9e3779b97f4a7c15ULL, 31);
+    }
+
+    std::uint64_t state_ = 0;
+    std::uint64_t length_ = 0;
+    std::array<char, sizeof(std::uint64_t)> pending_{};
+    std::size_t pendingSize_ = 0;
+};
+
+// Writes `data` to a temporary sibling of `path` and renames it over the
+// target, so readers see either the old file or the complete new one.
+inline bool writeFileAtomically(const std::string &path, std::string_view data)
+{
+    const auto temp = path + ".tmp";
+#if defined(__unix__) || defined(__APPLE__)
+    const int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    std::size_t written = 0;
+    while (written < data.size())
+    {
+        const auto n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0)
+        {
+            ::close(fd);
+            std::remove(temp.c_str());
+            return false;
+        }
+        written += static_cast<std::size_t>(n);
+    }
+    const bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    if (!synced || std::rename(temp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+#else
+    {
+        std::ofstream output(temp, std::ios::binary | std::ios::trunc);
+        if (!output.write(data.data(), static_cast<std::streamsize>(data.size())))
+        {
+            return false;
+        }
+    }
+    std::remove(path.c_str());
+    return std::rename(temp.c_str(), path.c_str()) == 0;
+#endif
+}
+
+// Native-endian binary encoding used by RosterManager snapshots.
+class SnapshotWriter
+{
+public:
+    template <typename T>
+    void put(T value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        buffer_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void putString(std::string_view text)
+    {
+        put(static_cast<std::uint32_t>(text.size()));
+        buffer_.append(text.data(), text.size());
+    }
+
+    const std::string &data() const
+    {
+        return buffer_;
+    }
+
+private:
+    std::string buffer_;
+};
+
+// Bounds-checked counterpart of SnapshotWriter; every getter returns false
+// once the input is exhausted, so truncated files are rejected.
+class SnapshotReader
+{
+public:
+    explicit SnapshotReader(std::string_view data) : data_(data) {}
+
+    template <typename T>
+    bool get(T &value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (data_.size() - offset_ < sizeof(value))
+        {
+            return false;
+        }
+        std::memcpy(&value, data_.data() + offset_, sizeof(value));
+        offset_ += sizeof(value);
+        return true;
+    }
+
+    bool getString(std::string_view &text)
+    {
+        std::uint32_t size = 0;
+        if (!get(size) || data_.size() - offset_ < size)
+        {
+            return false;
+        }
+        text = data_.substr(offset_, size);
+        offset_ += size;
+        return true;
+    }
+
+    // Guards container reservations against corrupt counts.
+    bool canHold(std::uint64_t count, std::size_t elementSize) const
+    {
+        return count <= (data_.size() - offset_) / elementSize;
+    }
+
+    bool atEnd() const
+    {
+        return offset_ == data_.size();
+    }
+
+private:
+    std::string_view data_;
+    std::size_t offset_ = 0;
+};
+
+inline void localTime(std::time_t time, std::tm &local)
+{
+#if defined(_WIN32)
+    ::localtime_s(&local, &time);
+#else
+    ::localtime_r(&time, &local);
+#endif
+}
+
+// Formats timestamps as local "YYYY-MM-DD HH:MM:SS". The calendar part is
+// recomputed only when the minute changes; within a minute just the two
+// seconds digits are patched, so long runs of records skip localtime.
+class TimestampFormatter
+{
+public:
+    std::string_view format(std::chrono::system_clock::time_point timestamp)
+    {
+        const auto seconds = std::chrono::floor<std::chrono::seconds>(timestamp.time_since_epoch()).count();
+        const auto minute = seconds / 60 - (seconds % 60 < 0 ? 1 : 0);
+        if (!cached_ || minute != minute_)
+        {
+            std::tm local{};
+            localTime(static_cast<std::time_t>(minute * 60), local);
+            prefix_ = std::strftime(text_.data(), text_.size(), "%F %H:%M:", &local);
+            minute_ = minute;
+            cached_ = true;
+        }
+        const auto second = static_cast<int>(seconds - minute * 60);
+        text_[prefix_] = static_cast<char>('0' + second / 10);
+        text_[prefix_ + 1] = static_cast<char>('0' + second % 10);
+        return {text_.data(), prefix_ + 2};
+    }
+
+private:
+    std::array<char, 40> text_{};
+    std::size_t prefix_ = 0;
+    std::int64_t minute_ = 0;
+    bool cached_ = false;
+};
+
+// Output staged in one reusable buffer and handed to the sink in large
+// writes. Numbers go through std::to_chars, so nothing depends on the
+// stream locale. A failed write makes every later flush fail too.
+class OutputBuffer
+{
+public:
+    using Sink = std::function<bool(std::string_view)>;
+
+    static constexpr std::size_t capacity = 1 << 20;
+
+    explicit OutputBuffer(Sink sink)
+        : sink_(std::move(sink))
+    {
+        buffer_.reserve(capacity);
+    }
+
+    OutputBuffer(const OutputBuffer &) = delete;
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+    void append(std::string_view text)
+    {
+        buffer_.append(text);
+        flushIfFull();
+    }
+
+    void push_back(char c)
+    {
+        buffer_.push_back(c);
+        flushIfFull();
+    }
+
+    template <typename T>
+    void appendNumber(T value)
+    {
+        std::array<char, 24> digits;
+        const auto end = std::to_chars(digits.data(), digits.data() + digits.size(), value).ptr;
+        append({digits.data(), static_cast<std::size_t>(end - digits.data())});
+    }
+
+    // Left-aligned in a field of `width` bytes, like std::setw with
+    // std::left.
+    void appendPadded(std::string_view text, std::size_t width)
+    {
+        append(text);
+        if (text.size() < width)
+        {
+            buffer_.append(width - text.size(), ' ');
+        }
+    }
+
+    // Native-endian, matching SnapshotWriter.
+    template <typename T>
+    void put(T value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        buffer_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        flushIfFull();
+    }
+
+    void putString(std::string_view text)
+    {
+        put(static_cast<std::uint32_t>(text.size()));
+        append(text);
+    }
+
+    bool flush()
+    {
+        if (ok_ && !buffer_.empty())
+        {
+            ok_ = sink_(buffer_);
+        }
+        buffer_.clear();
+        return ok_;
+    }
+
+    static Sink streamSink(std::ostream &out)
+    {
+        return [&out](std::string_view data)
+        { return static_cast<bool>(out.write(data.data(), static_cast<std::streamsize>(data.size()))); };
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    static Sink fdSink(int fd)
+    {
+        return [fd](std::string_view data)
+        {
+            while (!data.empty())
+            {
+                const auto n = ::write(fd, data.data(), data.size());
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n < 0)
+                {
+                    return false;
+                }
+                data.remove_prefix(static_cast<std::size_t>(n));
+            }
+            return true;
+        };
+    }
+#endif
+
+private:
+    void flushIfFull()
+    {
+        if (buffer_.size() >= capacity)
+        {
+            flush();
+        }
+    }
+
+    Sink sink_;
+    std::string buffer_;
+    bool ok_ = true;
+};
+
+enum class ExportFormat
+{
+    csv,
+    jsonLines,
+    binary
+};
+
+// Picks the export format from a file name: .jsonl/.json, .bin, else CSV.
+inline ExportFormat exportFormatFor(std::string_view path)
+{
+    if (path.ends_with(".jsonl") || path.ends_with(".json"))
+    {
+        return ExportFormat::jsonLines;
+    }
+    if (path.ends_with(".bin"))
+    {
+        return ExportFormat::binary;
+    }
+    return ExportFormat::csv;
+}
+
+// Coroutine that runs one slice per step(): it starts suspended and every
+// co_await std::suspend_always{} hands control back to whoever is driving
+// it, so a long job can be interleaved with other work on the same thread.
+template <typename Result>
+class Task
+{
+public:
+    struct promise_type
+    {
+        Result result{};
+
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_value(Result value)
+        {
+            result = std::move(value);
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, {}))
+    {
+    }
+
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+            {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    bool done() const
+    {
+        return !handle_ || handle_.done();
+    }
+
+    // Runs the next slice. Returns true while there is more to do.
+    bool step()
+    {
+        if (!done())
+        {
+            handle_.resume();
+        }
+        return !done();
+    }
+
+    Result run()
+    {
+        while (step())
+        {
+        }
+        return result();
+    }
+
+    Result &result()
+    {
+        return handle_.promise().result;
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// Tells whoever steps a coroutine that it can make progress again. The
+// driver either blocks in wait() or, on Linux, watches fd() (an eventfd) in
+// its poll loop and calls clear() before stepping.
+class Wakeup
+{
+public:
+    Wakeup()
+#if defined(__linux__)
+        : fd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+#endif
+    {
+    }
+
+    Wakeup(const Wakeup &) = delete;
+    Wakeup &operator=(const Wakeup &) = delete;
+
+    ~Wakeup()
+    {
+#if defined(__linux__)
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
+#endif
+    }
+
+    void notify()
+    {
+        {
+            const std::lock_guard lock(mutex_);
+            pending_ = true;
+        }
+        ready_.notify_all();
+#if defined(__linux__)
+        const std::uint64_t one = 1;
+        [[maybe_unused]] const auto n = ::write(fd_, &one, sizeof(one));
+#endif
+    }
+
+    // Returns once notify() has been called since the last wait or clear.
+    void wait()
+    {
+        std::unique_lock lock(mutex_);
+        ready_.wait(lock, [this] { return pending_; });
+        lock.unlock();
+        clear();
+    }
+
+    void clear()
+    {
+        {
+            const std::lock_guard lock(mutex_);
+            pending_ = false;
+        }
+#if defined(__linux__)
+        std::uint64_t count = 0;
+        [[maybe_unused]] const auto n = ::read(fd_, &count, sizeof(count));
+#endif
+    }
+
+#if defined(__linux__)
+    int fd() const
+    {
+        return fd_;
+    }
+#endif
+
+private:
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool pending_ = false;
+#if defined(__linux__)
+    int fd_ = -1;
+#endif
+};
+
+// Fixed-capacity hand-off between a pipeline thread and a coroutine. The
+// thread side blocks (until stopped) and notifies `wakeup` whenever it
+// pushes, pops or closes; the coroutine side only ever tries, so it can
+// suspend instead of stalling whoever is stepping it.
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(std::size_t capacity, Wakeup &wakeup) : capacity_(std::max<std::size_t>(1, capacity)), wakeup_(wakeup)
+    {
+    }
+
+    bool push(T value, std::stop_token stop)
+    {
+        std::unique_lock lock(mutex_);
+        if (!notFull_.wait(lock, stop, [this] { return closed_ || items_.size() < capacity_; }) || closed_)
+        {
+            return false;
+        }
+        items_.push_back(std::move(value));
+        notEmpty_.notify_one();
+        lock.unlock();
+        wakeup_.notify();
+        return true;
+    }
+
+    // Empty once the queue is closed and drained.
+    std::optional<T> pop(std::stop_token stop)
+    {
+        std::unique_lock lock(mutex_);
+        if (!notEmpty_.wait(lock, stop, [this] { return closed_ || !items_.empty(); }) || items_.empty())
+        {
+            return std::nullopt;
+        }
+        T value = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        lock.unlock();
+        wakeup_.notify();
+        return value;
+    }
+
+    // Leaves `value` untouched when the queue is full.
+    bool tryPush(T &value)
+    {
+        const std::lock_guard lock(mutex_);
+        if (closed_ || items_.size() >= capacity_)
+        {
+            return false;
+        }
+        items_.push_back(std::move(value));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    // Sets `drained` when nothing is queued and nothing more will be.
+    std::optional<T> tryPop(bool &drained)
+    {
+        const std::lock_guard lock(mutex_);
+        drained = closed_ && items_.empty();
+        if (items_.empty())
+        {
+            return std::nullopt;
+        }
+        T value = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        return value;
+    }
+
+    void close()
+    {
+        {
+            const std::lock_guard lock(mutex_);
+            closed_ = true;
+            notFull_.notify_all();
+            notEmpty_.notify_all();
+        }
+        wakeup_.notify();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable_any notFull_;
+    std::condition_variable_any notEmpty_;
+    std::deque<T> items_;
+    std::size_t capacity_;
+    Wakeup &wakeup_;
+    bool closed_ = false;
+};
+
+enum class WalSync
+{
+    never,  // leave durability to the OS page cache
+    batch,  // fsync once per group commit
+    always, // flush and fsync every record
+};
+
+struct WalOptions
+{
+    std::size_t batchRecords = 64;
+    WalSync sync = WalSync::batch;
+    // Roster changes fold the log into a new snapshot once it holds this
+    // many records.
+    std::uint64_t checkpointRecords = 1 << 20;
+};
+
+// Append-only log of fixed-size records. Appends are buffered and written as
+// one group commit every `batchRecords` records (or on flush()); a torn
+// record at the tail of a crashed log is ignored on replay.
+template <typename Record>
+class WriteAheadLog
+{
+public:
+    WriteAheadLog() = default;
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    ~WriteAheadLog()
+    {
+        close();
+    }
+
+    // Calls `apply(sequence, record)` for every complete record in `path`.
+    // Returns false if the file exists but is not a log of this record type.
+    template <typename Apply>
+    static bool replay(const std::string &path, Apply &&apply)
+    {
+        const MappedFile file(path);
+        if (!file.isOpen())
+        {
+            return true;
+        }
+        SnapshotReader in(file.view());
+        Header header{};
+        if (!in.get(header) || header.magic != magic || header.version != version ||
+            header.recordSize != sizeof(Record))
+        {
+            return false;
+        }
+        Record record{};
+        for (auto sequence = header.baseSequence; in.get(record); ++sequence)
+        {
+            apply(sequence, record);
+        }
+        return true;
+    }
+
+    // Starts a fresh, empty log whose first record will carry `baseSequence`.
+    bool create(const std::string &path, std::uint64_t baseSequence, WalOptions options)
+    {
+        close();
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_)
+        {
+            return false;
+        }
+        options_ = options;
+        const Header header{magic, version, static_cast<std::uint32_t>(sizeof(Record)), baseSequence};
+        if (std::fwrite(&header, sizeof(header), 1, file_) != 1 || !sync())
+        {
+            close();
+            return false;
+        }
+        pending_.reserve(options_.batchRecords);
+        return true;
+    }
+
+    void append(const Record &record)
+    {
+        pending_.push_back(record);
+        if (options_.sync == WalSync::always || pending_.size() >= options_.batchRecords)
+        {
+            flush();
+        }
+    }
+
+    bool flush()
+    {
+        if (!file_ || pending_.empty())
+        {
+            return true;
+        }
+        const bool written = std::fwrite(pending_.data(), sizeof(Record), pending_.size(), file_) == pending_.size();
+        pending_.clear();
+        return written && sync();
+    }
+
+    void close()
+    {
+        if (!file_)
+        {
+            return;
+        }
+        flush();
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+
+    bool isOpen() const
+    {
+        return file_ != nullptr;
+    }
+
+private:
+    struct Header
+    {
+        std::uint64_t magic;
+        std::uint32_t version;
+        std::uint32_t recordSize;
+        std::uint64_t baseSequence;
+    };
+
+    static constexpr std::uint64_t magic = 0x4c4157534c4c4143; // "CALLSWAL"
+    static constexpr std::uint32_t version = 1;
+
+    bool sync()
+    {
+        if (std::fflush(file_) != 0)
+        {
+            return false;
+        }
+#if defined(__unix__) || defined(__APPLE__)
+        if (options_.sync != WalSync::never)
+        {
+            return ::fsync(::fileno(file_)) == 0;
+        }
+#endif
+        return true;
+    }
+
+    std::FILE *file_ = nullptr;
+    WalOptions options_;
+    std::vector<Record> pending_;
+};
+
+// Small dense id for the calling thread, handed out on first use.
+inline std::size_t threadSlot()
+{
+    static std::atomic<std::size_t> next{0};
+    thread_local const std::size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+// Reader/writer lock split into cache-line sized shards. Readers only touch
+// the shard of their own thread, so shared locking does not bounce a single
+// cache line between cores; writers take every shard.
+class ShardedSharedMutex
+{
+public:
+    void lock()
+    {
+        for (auto &shard : shards_)
+        {
+            shard.mutex.lock();
+        }
+    }
+
+    void unlock()
+    {
+        for (auto it = shards_.rbegin(); it != shards_.rend(); ++it)
+        {
+            it->mutex.unlock();
+        }
+    }
+
+    void lock_shared()
+    {
+        shards_[threadSlot() % shardCount].mutex.lock_shared();
+    }
+
+    void unlock_shared()
+    {
+        shards_[threadSlot() % shardCount].mutex.unlock_shared();
+    }
+
+private:
+    static constexpr std::size_t shardCount = 16;
+
+    struct alignas(64) Shard
+    {
+        std::shared_mutex mutex;
+    };
+
+    std::array<Shard, shardCount> shards_;
+};
+
+// Takes the place of every mutex in a build with no threads to guard against.
+class NullMutex
+{
+public:
+    void lock()
+    {
+    }
+
+    void unlock()
+    {
+    }
+
+    void lock_shared()
+    {
+    }
+
+    void unlock_shared()
+    {
+    }
+};
+
+// Hot-path counters and latency histograms. Each thread records into its own
+// cache-line-aligned shard with relaxed atomics and readers sum the shards.
+// The shards are allocated on first enable; while disabled, recording is one
+// relaxed load and no clock is read.
+class Metrics
+{
+public:
+    enum Counter : std::size_t
+    {
+        globalPicks,
+        groupPicks,
+        weightedPicks,
+        globalRestarts,
+        groupRestarts,
+        importedRows,
+        importedBytes,
+        counterCount
+    };
+
+    enum Histogram : std::size_t
+    {
+        globalPickLatency,
+        groupPickLatency,
+        batchPickLatency,
+        weightedPickLatency,
+        importLatency,
+        histogramCount
+    };
+
+    // Bucket i counts durations below 2^i ns; the last one is unbounded.
+    static constexpr std::size_t bucketCount = 36;
+
+    struct Sample
+    {
+        std::array<std::uint64_t, counterCount> counters{};
+        std::array<std::array<std::uint64_t, bucketCount>, histogramCount> buckets{};
+        std::array<std::uint64_t, histogramCount> sums{};
+    };
+
+    // Records the lifetime of the timer, if metrics were on when it started.
+    class Timer
+    {
+    public:
+        Timer(const Metrics &metrics, Histogram histogram)
+            : metrics_(metrics.enabled() ? &metrics : nullptr), histogram_(histogram)
+        {
+            if (metrics_)
+            {
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+        ~Timer()
+        {
+            if (metrics_)
+            {
+                metrics_->record(histogram_, std::chrono::steady_clock::now() - start_);
+            }
+        }
+
+    private:
+        const Metrics *metrics_;
+        Histogram histogram_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // Timer for a coroutine: `co_await timer.pause()` suspends it with the
+    // clock stopped, so only the time spent inside steps is recorded.
+    class StepTimer
+    {
+    public:
+        struct Pause
+        {
+            StepTimer &timer;
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<>) const noexcept
+            {
+                timer.stop();
+            }
+
+            void await_resume() const noexcept
+            {
+                timer.start();
+            }
+        };
+
+        StepTimer(const Metrics &metrics, Histogram histogram)
+            : metrics_(metrics.enabled() ? &metrics : nullptr), histogram_(histogram)
+        {
+            start();
+        }
+
+        StepTimer(const StepTimer &) = delete;
+        StepTimer &operator=(const StepTimer &) = delete;
+
+        ~StepTimer()
+        {
+            if (metrics_)
+            {
+                stop();
+                metrics_->record(histogram_, elapsed_);
+            }
+        }
+
+        Pause pause()
+        {
+            return Pause{*this};
+        }
+
+    private:
+        void start()
+        {
+            if (metrics_)
+            {
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+
+        void stop()
+        {
+            if (metrics_)
+            {
+                elapsed_ += std::chrono::steady_clock::now() - start_;
+            }
+        }
+
+        const Metrics *metrics_;
+        Histogram histogram_;
+        std::chrono::steady_clock::time_point start_;
+        std::chrono::steady_clock::duration elapsed_{};
+    };
+
+    Metrics() = default;
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+    // Not meant to race with itself; recording may run concurrently.
+    void setEnabled(bool enabled)
+    {
+        if (enabled && !storage_)
+        {
+            storage_ = std::make_unique<Shards>();
+        }
+        active_.store(enabled ? storage_.get() : nullptr, std::memory_order_release);
+    }
+
+    bool enabled() const
+    {
+        return active_.load(std::memory_order_relaxed) != nullptr;
+    }
+
+    void add(Counter counter, std::uint64_t amount = 1) const
+    {
+        if (auto *shards = active_.load(std::memory_order_relaxed))
+        {
+            (*shards)[threadSlot() % shardCount].counters[counter].fetch_add(amount, std::memory_order_relaxed);
+        }
+    }
+
+    // Totals so far; counts recorded while disabled are not included.
+    Sample read() const
+    {
+        Sample sample;
+        if (!storage_)
+        {
+            return sample;
+        }
+        for (const auto &shard : *storage_)
+        {
+            for (std::size_t c = 0; c < counterCount; ++c)
+            {
+                sample.counters[c] += shard.counters[c].load(std::memory_order_relaxed);
+            }
+            for (std::size_t h = 0; h < histogramCount; ++h)
+            {
+                for (std::size_t b = 0; b < bucketCount; ++b)
+                {
+                    sample.buckets[h][b] += shard.buckets[h][b].load(std::memory_order_relaxed);
+                }
+                sample.sums[h] += shard.sums[h].load(std::memory_order_relaxed);
+            }
+        }
+        return sample;
+    }
+
+private:
+    static constexpr std::size_t shardCount = 16;
+
+    struct alignas(64) Shard
+    {
+        std::array<std::atomic<std::uint64_t>, counterCount> counters{};
+        std::array<std::array<std::atomic<std::uint64_t>, bucketCount>, histogramCount> buckets{};
+        std::array<std::atomic<std::uint64_t>, histogramCount> sums{};
+    };
+
+    using Shards = std::array<Shard, shardCount>;
+
+    void record(Histogram histogram, std::chrono::steady_clock::duration elapsed) const
+    {
+        auto *shards = active_.load(std::memory_order_relaxed);
+        if (!shards)
+        {
+            return;
+        }
+        const auto nanoseconds =
+            static_cast<std::uint64_t>(std::max<std::int64_t>(0, std::chrono::nanoseconds(elapsed).count()));
+        const auto bucket = std::min<std::size_t>(std::bit_width(nanoseconds), bucketCount - 1);
+        auto &shard = (*shards)[threadSlot() % shardCount];
+        shard.buckets[histogram][bucket].fetch_add(1, std::memory_order_relaxed);
+        shard.sums[histogram].fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<Shards> storage_;
+    std::atomic<Shards *> active_{nullptr};
+};
+
+enum class MetricsFormat
+{
+    prometheus,
+    binary
+};
+
+// Metrics plus the gauges read from a manager at report time.
+struct MetricsReport
+{
+    Metrics::Sample sample;
+    std::uint64_t students = 0;
+    std::uint64_t groups = 0;
+    std::uint64_t historyRecords = 0;
+    std::uint64_t historyBytes = 0; // records plus the name and group indexes
+    double nameLoadFactor = 0;
+    double groupLoadFactor = 0;
+};
+
+// Writes one report per label set (such as `course="math"`, or empty), with
+// every metric family in one block as the Prometheus text format requires.
+inline void writeMetrics(OutputBuffer &out, MetricsFormat format,
+                         const std::vector<std::pair<std::string, MetricsReport>> &reports)
+{
+    if (format == MetricsFormat::binary)
+    {
+        out.put(std::uint64_t{0x5254454d52544352}); // "RCTRMETR"
+        out.put(std::uint32_t{1});
+        out.put(std::uint32_t{0x01020304});
+        out.put(static_cast<std::uint64_t>(reports.size()));
+        for (const auto &[labels, report] : reports)
+        {
+            out.putString(labels);
+            for (const auto value : report.sample.counters)
+            {
+                out.put(value);
+            }
+            for (std::size_t h = 0; h < Metrics::histogramCount; ++h)
+            {
+                for (const auto value : report.sample.buckets[h])
+                {
+                    out.put(value);
+                }
+                out.put(report.sample.sums[h]);
+            }
+            out.put(report.students);
+            out.put(report.groups);
+            out.put(report.historyRecords);
+            out.put(report.historyBytes);
+            out.put(report.nameLoadFactor);
+            out.put(report.groupLoadFactor);
+        }
+        return;
+    }
+
+    const auto line = [&out](std::string_view name, std::string_view labels, std::string_view extra, auto value)
+    {
+        out.append(name);
+        if (!labels.empty() || !extra.empty())
+        {
+            out.push_back('{');
+            out.append(labels);
+            if (!labels.empty() && !extra.empty())
+            {
+                out.push_back(',');
+            }
+            out.append(extra);
+            out.push_back('}');
+        }
+        out.push_back(' ');
+        out.appendNumber(value);
+        out.push_back('\n');
+    };
+    const auto family = [&](std::string_view name, std::string_view type,
+                            std::initializer_list<std::pair<std::string_view, Metrics::Counter>> series)
+    {
+        out.append("# TYPE ");
+        out.append(name);
+        out.push_back(' ');
+        out.append(type);
+        out.push_back('\n');
+        for (const auto &[labels, report] : reports)
+        {
+            for (const auto &[extra, counter] : series)
+            {
+                line(name, labels, extra, report.sample.counters[counter]);
+            }
+        }
+    };
+    family("roster_picks_total", "counter",
+           {{"pool=\"global\"", Metrics::globalPicks},
+            {"pool=\"group\"", Metrics::groupPicks},
+            {"pool=\"weighted\"", Metrics::weightedPicks}});
+    family("roster_cycle_restarts_total", "counter",
+           {{"pool=\"global\"", Metrics::globalRestarts}, {"pool=\"group\"", Metrics::groupRestarts}});
+    family("roster_imported_rows_total", "counter", {{"", Metrics::importedRows}});
+    family("roster_imported_bytes_total", "counter", {{"", Metrics::importedBytes}});
+
+    const auto histogram = [&](std::string_view name,
+                               std::initializer_list<std::pair<std::string_view, Metrics::Histogram>> series)
+    {
+        out.append("# TYPE ");
+        out.append(name);
+        out.append(" histogram\n");
+        const auto bucketName = std::string(name) + "_bucket";
+        const auto sumName = std::string(name) + "_sum";
+        const auto countName = std::string(name) + "_count";
+        for (const auto &[labels, report] : reports)
+        {
+            for (const auto &[extra, h] : series)
+            {
+                std::uint64_t cumulative = 0;
+                for (std::size_t b = 0; b < Metrics::bucketCount; ++b)
+                {
+                    cumulative += report.sample.buckets[h][b];
+                    std::string le(extra);
+                    le.append(extra.empty() ? "le=\"" : ",le=\"");
+                    if (b + 1 == Metrics::bucketCount)
+                    {
+                        le.append("+Inf");
+                    }
+                    else
+                    {
+                        std::array<char, 32> digits;
+                        const auto end = std::to_chars(digits.data(), digits.data() + digits.size(),
+                                                       std::ldexp(1e-9, static_cast<int>(b)))
+                                             .ptr;
+                        le.append(digits.data(), end);
+                    }
+                    le.push_back('"');
+                    line(bucketName, labels, le, cumulative);
+                }
+                line(sumName, labels, extra, static_cast<double>(report.sample.sums[h]) * 1e-9);
+                line(countName, labels, extra, cumulative);
+            }
+        }
+    };
+    histogram("roster_pick_duration_seconds",
+              {{"pool=\"global\"", Metrics::globalPickLatency},
+               {"pool=\"group\"", Metrics::groupPickLatency},
+               {"pool=\"batch\"", Metrics::batchPickLatency},
+               {"pool=\"weighted\"", Metrics::weightedPickLatency}});
+    histogram("roster_import_duration_seconds", {{"", Metrics::importLatency}});
+
+    const auto gauge = [&](std::string_view name, std::string_view extra, auto field)
+    {
+        out.append("# TYPE ");
+        out.append(name);
+        out.append(" gauge\n");
+        for (const auto &[labels, report] : reports)
+        {
+            line(name, labels, extra, report.*field);
+        }
+    };
+    gauge("roster_students", "", &MetricsReport::students);
+    gauge("roster_groups", "", &MetricsReport::groups);
+    gauge("roster_history_records", "", &MetricsReport::historyRecords);
+    gauge("roster_history_bytes", "", &MetricsReport::historyBytes);
+    out.append("# TYPE roster_string_table_load_factor gauge\n");
+    for (const auto &[labels, report] : reports)
+    {
+        line("roster_string_table_load_factor", labels, "table=\"names\"", report.nameLoadFactor);
+        line("roster_string_table_load_factor", labels, "table=\"groups\"", report.groupLoadFactor);
+    }
+}
+
+enum class ThreadingMode
+{
+    singleThreaded,
+    concurrent,
+};
+
+class StringTable
+{
+public:
+    using Id = std::uint32_t;
+
+    Id intern(std::string_view text)
+    {
+        const auto it = ids_.find(text);
+        if (it != ids_.end())
+        {
+            return it->second;
+        }
+        const auto id = static_cast<Id>(strings_.size());
+        // std::deque never relocates its elements on push_back, so the views
+        // used as map keys stay valid.
+        ids_.emplace(strings_.emplace_back(text), id);
+        return id;
+    }
+
+    std::optional<Id> find(std::string_view text) const
+    {
+        const auto it = ids_.find(text);
+        if (it == ids_.end())
+        {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    const std::pmr::string &operator[](Id id) const
+    {
+        return strings_[id];
+    }
+
+    std::size_t size() const
+    {
+        return strings_.size();
+    }
+
+    double loadFactor() const
+    {
+        return ids_.load_factor();
+    }
+
+    explicit StringTable(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : strings_(memory), ids_(memory)
+    {
+    }
+
+    StringTable(StringTable &&) = default;
+
+    // Between tables on different resources the strings are copied rather
+    // than stolen, so the keys have to be rebuilt to point at the copies.
+    StringTable &operator=(StringTable &&other)
+    {
+        const bool shared = strings_.get_allocator() == other.strings_.get_allocator();
+        strings_ = std::move(other.strings_);
+        ids_ = std::move(other.ids_);
+        if (!shared)
+        {
+            ids_.clear();
+            for (Id id = 0; id < strings_.size(); ++id)
+            {
+                ids_.emplace(strings_[id], id);
+            }
+        }
+        return *this;
+    }
+
+    // Copies would leave the keys pointing into the source's storage.
+    StringTable(const StringTable &) = delete;
+    StringTable &operator=(const StringTable &) = delete;
+
+private:
+    std::pmr::deque<std::pmr::string> strings_;
+    std::pmr::unordered_map<std::string_view, Id> ids_;
+};
+
+// Append-only record log stored in fixed-size contiguous chunks. With a
+// retention cap the oldest records are evicted (optionally through a handler
+// that gets to persist them) and their chunks are recycled for new appends.
+template <typename Record>
+class ChunkedHistory
+{
+public:
+    static constexpr bool keepsRecords = true;
+    static constexpr std::size_t chunkCapacity = 4096;
+    using EvictionHandler = std::function<void(const Record *, std::size_t)>;
+
+    explicit ChunkedHistory(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : chunks_(memory), spare_(memory)
+    {
+    }
+
+    void push_back(const Record &record)
+    {
+        if (retention_ && size_ == retention_)
+        {
+            evict(1);
+        }
+        const auto pos = head_ + size_;
+        if (pos == chunks_.size() * chunkCapacity)
+        {
+            addChunk();
+        }
+        chunks_[pos / chunkCapacity][pos % chunkCapacity] = record;
+        ++size_;
+    }
+
+    template <typename It>
+    void append(It first, It last)
+    {
+        for (; first != last; ++first)
+        {
+            push_back(*first);
+        }
+    }
+
+    // Index 0 is the oldest retained record.
+    const Record &operator[](std::size_t i) const
+    {
+        const auto pos = head_ + i;
+        return chunks_[pos / chunkCapacity][pos % chunkCapacity];
+    }
+
+    const Record &fromBack(std::size_t i) const
+    {
+        return (*this)[size_ - 1 - i];
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    // Chunk storage held, including recycled chunks kept for reuse.
+    std::size_t memoryBytes() const
+    {
+        return (chunks_.size() + spare_.size()) * chunkCapacity * sizeof(Record);
+    }
+
+    // Every record gets a sequence number that survives eviction; index 0
+    // holds sequence firstSequence().
+    std::uint64_t firstSequence() const
+    {
+        return dropped_;
+    }
+
+    std::uint64_t nextSequence() const
+    {
+        return dropped_ + size_;
+    }
+
+    void clear()
+    {
+        while (!chunks_.empty())
+        {
+            recycleFront();
+        }
+        dropped_ += size_;
+        head_ = 0;
+        size_ = 0;
+    }
+
+    std::size_t retention() const
+    {
+        return retention_;
+    }
+
+    // 0 keeps everything.
+    void setRetention(std::size_t retention)
+    {
+        retention_ = retention;
+        if (retention_ && size_ > retention_)
+        {
+            evict(size_ - retention_);
+        }
+    }
+
+    void setEvictionHandler(EvictionHandler handler)
+    {
+        onEvict_ = std::move(handler);
+    }
+
+private:
+    void evict(std::size_t count)
+    {
+        while (count)
+        {
+            const auto run = std::min(count, chunkCapacity - head_);
+            if (onEvict_)
+            {
+                onEvict_(&chunks_.front()[head_], run);
+            }
+            head_ += run;
+            size_ -= run;
+            dropped_ += run;
+            count -= run;
+            if (head_ == chunkCapacity)
+            {
+                recycleFront();
+                head_ = 0;
+            }
+        }
+    }
+
+    void addChunk()
+    {
+        if (spare_.empty())
+        {
+            chunks_.emplace_back(chunkCapacity);
+            return;
+        }
+        chunks_.push_back(std::move(spare_.back()));
+        spare_.pop_back();
+    }
+
+    void recycleFront()
+    {
+        spare_.push_back(std::move(chunks_.front()));
+        chunks_.pop_front();
+    }
+
+    std::pmr::deque<std::pmr::vector<Record>> chunks_;
+    std::pmr::vector<std::pmr::vector<Record>> spare_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+    std::uint64_t dropped_ = 0;
+    std::size_t retention_ = 0;
+    EvictionHandler onEvict_;
+};
+
+// ChunkedHistory for records of two 32-bit ids and a timestamp, in about 12
+// bytes a record instead of 16: every block of 64 records in a chunk keeps
+// the time of its first record as a base, and each record a signed 32-bit
+// millisecond offset from it (about 24 days either way). Timestamps are kept
+// to the millisecond; a record further from its base keeps its full time on
+// the side. Records come back by value.
+template <typename Record>
+class CompactHistory
+{
+public:
+    static constexpr bool keepsRecords = true;
+    static constexpr std::size_t chunkCapacity = 4096;
+    using EvictionHandler = std::function<void(const Record *, std::size_t)>;
+
+    explicit CompactHistory(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : chunks_(memory), spare_(memory), evicted_(memory)
+    {
+    }
+
+    void push_back(const Record &record)
+    {
+        if (retention_ && size_ == retention_)
+        {
+            evict(1);
+        }
+        const auto pos = head_ + size_;
+        if (pos == chunks_.size() * chunkCapacity)
+        {
+            addChunk();
+        }
+        auto &chunk = chunks_[pos / chunkCapacity];
+        const auto slot = pos % chunkCapacity;
+        const auto time = ticks(record.timestamp);
+        auto &base = chunk.bases[slot / blockSize];
+        if (slot % blockSize == 0)
+        {
+            base = time;
+        }
+        auto &entry = chunk.entries[slot];
+        entry.nameId = record.nameId;
+        entry.groupId = record.groupId;
+        const auto offset = time - base;
+        if (offset > farOffset && offset <= std::numeric_limits<std::int32_t>::max())
+        {
+            entry.offset = static_cast<std::int32_t>(offset);
+        }
+        else
+        {
+            entry.offset = farOffset;
+            chunk.far.push_back(FarTime{slot, time});
+        }
+        ++size_;
+    }
+
+    template <typename It>
+    void append(It first, It last)
+    {
+        for (; first != last; ++first)
+        {
+            push_back(*first);
+        }
+    }
+
+    // Index 0 is the oldest retained record.
+    Record operator[](std::size_t i) const
+    {
+        const auto pos = head_ + i;
+        return decode(chunks_[pos / chunkCapacity], pos % chunkCapacity);
+    }
+
+    Record fromBack(std::size_t i) const
+    {
+        return (*this)[size_ - 1 - i];
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    std::size_t memoryBytes() const
+    {
+        std::size_t far = 0;
+        for (const auto &chunk : chunks_)
+        {
+            far += chunk.far.capacity();
+        }
+        return (chunks_.size() + spare_.size()) * (chunkCapacity * sizeof(Entry) + blocks * sizeof(std::int64_t)) +
+               far * sizeof(FarTime);
+    }
+
+    std::uint64_t firstSequence() const
+    {
+        return dropped_;
+    }
+
+    std::uint64_t nextSequence() const
+    {
+        return dropped_ + size_;
+    }
+
+    void clear()
+    {
+        while (!chunks_.empty())
+        {
+            recycleFront();
+        }
+        dropped_ += size_;
+        head_ = 0;
+        size_ = 0;
+    }
+
+    std::size_t retention() const
+    {
+        return retention_;
+    }
+
+    // 0 keeps everything.
+    void setRetention(std::size_t retention)
+    {
+        retention_ = retention;
+        if (retention_ && size_ > retention_)
+        {
+            evict(size_ - retention_);
+        }
+    }
+
+    void setEvictionHandler(EvictionHandler handler)
+    {
+        onEvict_ = std::move(handler);
+    }
+
+private:
+    static constexpr std::size_t blockSize = 64;
+    static constexpr std::size_t blocks = chunkCapacity / blockSize;
+    // Marks an entry whose time is in its chunk's far list.
+    static constexpr std::int32_t farOffset = std::numeric_limits<std::int32_t>::min();
+
+    struct Entry
+    {
+        std::uint32_t nameId;
+        std::uint32_t groupId;
+        std::int32_t offset;
+    };
+
+    struct FarTime
+    {
+        std::size_t slot;
+        std::int64_t time;
+    };
+
+    struct Chunk
+    {
+        explicit Chunk(std::pmr::memory_resource *memory)
+            : entries(chunkCapacity, memory), bases(blocks, memory), far(memory)
+        {
+        }
+
+        std::pmr::vector<Entry> entries;
+        std::pmr::vector<std::int64_t> bases;
+        // Sorted by slot, as slots are filled in order.
+        std::pmr::vector<FarTime> far;
+    };
+
+    static std::int64_t ticks(std::chrono::system_clock::time_point time)
+    {
+        return std::chrono::floor<std::chrono::milliseconds>(time.time_since_epoch()).count();
+    }
+
+    static Record decode(const Chunk &chunk, std::size_t slot)
+    {
+        const auto &entry = chunk.entries[slot];
+        auto time = chunk.bases[slot / blockSize] + entry.offset;
+        if (entry.offset == farOffset)
+        {
+            time = std::ranges::lower_bound(chunk.far, slot, {}, &FarTime::slot)->time;
+        }
+        const std::chrono::system_clock::time_point timestamp(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::milliseconds(time)));
+        return Record{entry.nameId, entry.groupId, timestamp};
+    }
+
+    void evict(std::size_t count)
+    {
+        while (count)
+        {
+            const auto run = std::min(count, chunkCapacity - head_);
+            if (onEvict_)
+            {
+                evicted_.clear();
+                for (std::size_t i = 0; i < run; ++i)
+                {
+                    evicted_.push_back(decode(chunks_.front(), head_ + i));
+                }
+                onEvict_(evicted_.data(), run);
+            }
+            head_ += run;
+            size_ -= run;
+            dropped_ += run;
+            count -= run;
+            if (head_ == chunkCapacity)
+            {
+                recycleFront();
+                head_ = 0;
+            }
+        }
+    }
+
+    void addChunk()
+    {
+        if (spare_.empty())
+        {
+            chunks_.emplace_back(chunks_.get_allocator().resource());
+            return;
+        }
+        chunks_.push_back(std::move(spare_.back()));
+        spare_.pop_back();
+    }
+
+    void recycleFront()
+    {
+        chunks_.front().far.clear();
+        spare_.push_back(std::move(chunks_.front()));
+        chunks_.pop_front();
+    }
+
+    std::pmr::deque<Chunk> chunks_;
+    std::pmr::vector<Chunk> spare_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+    std::uint64_t dropped_ = 0;
+    std::size_t retention_ = 0;
+    EvictionHandler onEvict_;
+    // Evicted records, decoded for the handler.
+    std::pmr::vector<Record> evicted_;
+};
+
+// ChunkedHistory's interface with nothing behind it: every record is dropped
+// on arrival, so the history always reads as empty.
+template <typename Record>
+class NullHistory
+{
+public:
+    static constexpr bool keepsRecords = false;
+    using EvictionHandler = std::function<void(const Record *, std::size_t)>;
+
+    explicit NullHistory(std::pmr::memory_resource * = std::pmr::get_default_resource())
+    {
+    }
+
+    void push_back(const Record &)
+    {
+        ++dropped_;
+    }
+
+    template <typename It>
+    void append(It first, It last)
+    {
+        dropped_ += static_cast<std::uint64_t>(std::distance(first, last));
+    }
+
+    // Never called: there is no valid index.
+    const Record &operator[](std::size_t) const
+    {
+        std::terminate();
+    }
+
+    const Record &fromBack(std::size_t i) const
+    {
+        return (*this)[i];
+    }
+
+    std::size_t size() const
+    {
+        return 0;
+    }
+
+    bool empty() const
+    {
+        return true;
+    }
+
+    std::size_t memoryBytes() const
+    {
+        return 0;
+    }
+
+    std::uint64_t firstSequence() const
+    {
+        return dropped_;
+    }
+
+    std::uint64_t nextSequence() const
+    {
+        return dropped_;
+    }
+
+    void clear()
+    {
+    }
+
+    std::size_t retention() const
+    {
+        return 0;
+    }
+
+    void setRetention(std::size_t)
+    {
+    }
+
+    void setEvictionHandler(EvictionHandler)
+    {
+    }
+
+private:
+    std::uint64_t dropped_ = 0;
+};
+
+// Secondary index from a key (a name or group id) to the sequence numbers of
+// its history records, in append order. Evicted entries are skipped by
+// lookups and swept from every key once the evictions since the last sweep
+// reach half the index, so memory stays proportional to the live history.
+class SequenceIndex
+{
+public:
+    explicit SequenceIndex(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : sequences_(memory)
+    {
+    }
+
+    // `firstLive` is the oldest sequence still held by the history.
+    void add(std::uint32_t key, std::uint64_t sequence, std::uint64_t firstLive)
+    {
+        if (key >= sequences_.size())
+        {
+            sequences_.resize(key + 1);
+        }
+        sequences_[key].push_back(sequence);
+        ++size_;
+        if (firstLive > sweptTo_ && firstLive - sweptTo_ >= std::max<std::uint64_t>(size_ / 2, sequences_.size()))
+        {
+            trim(firstLive);
+        }
+    }
+
+    // Drops every entry older than `firstLive`; called directly after the
+    // history shrinks without an append.
+    void trim(std::uint64_t firstLive)
+    {
+        size_ = 0;
+        for (auto &sequences : sequences_)
+        {
+            sequences.erase(sequences.begin(), std::lower_bound(sequences.begin(), sequences.end(), firstLive));
+            if (sequences.capacity() > 4 * sequences.size() + 16)
+            {
+                sequences.shrink_to_fit();
+            }
+            size_ += sequences.size();
+        }
+        sweptTo_ = firstLive;
+    }
+
+    std::span<const std::uint64_t> find(std::uint32_t key, std::uint64_t firstLive) const
+    {
+        if (key >= sequences_.size())
+        {
+            return {};
+        }
+        const std::span<const std::uint64_t> all(sequences_[key]);
+        const auto live = std::lower_bound(all.begin(), all.end(), firstLive);
+        return all.subspan(static_cast<std::size_t>(live - all.begin()));
+    }
+
+    // Sequence numbers held across all keys, evicted ones included.
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    // Keeps the per-key buffers so that refilling the history reuses them.
+    void clear()
+    {
+        for (auto &sequences : sequences_)
+        {
+            sequences.clear();
+        }
+        size_ = 0;
+        sweptTo_ = 0;
+    }
+
+private:
+    std::pmr::vector<std::pmr::vector<std::uint64_t>> sequences_;
+    std::size_t size_ = 0;
+    std::uint64_t sweptTo_ = 0;
+};
+
+// Expands a single seed into well-mixed words; used to fill the state of the
+// engines below so that nearby seeds still give unrelated streams.
+inline std::uint64_t splitMix64(std::uint64_t &state)
+{
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// xoshiro256** (Blackman & Vigna): 32 bytes of state, cheap enough to keep
+// one per thread or per pool. Streams its state as text like the standard
+// engines, which is how snapshots store it.
+class Xoshiro256StarStar
+{
+public:
+    using result_type = std::uint64_t;
+    static constexpr std::string_view name = "xoshiro256**";
+
+    explicit Xoshiro256StarStar(std::uint64_t value = 0)
+    {
+        seed(value);
+    }
+
+    static constexpr result_type min()
+    {
+        return 0;
+    }
+
+    static constexpr result_type max()
+    {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    void seed(std::uint64_t value)
+    {
+        for (auto &word : state_)
+        {
+            word = splitMix64(value);
+        }
+    }
+
+    result_type operator()()
+    {
+        const auto result = rotl(state_[1] * 5, 7) * 9;
+        const auto t = state_[1] << 17;
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= t;
+        state_[3] = rotl(state_[3], 45);
+        return result;
+    }
+
+    friend std::ostream &operator<<(std::ostream &out, const Xoshiro256StarStar &rng)
+    {
+        return out << rng.state_[0] << ' ' << rng.state_[1] << ' ' << rng.state_[2] << ' ' << rng.state_[3];
+    }
+
+    friend std::istream &operator>>(std::istream &in, Xoshiro256StarStar &rng)
+    {
+        std::array<std::uint64_t, 4> state{};
+        if (in >> state[0] >> state[1] >> state[2] >> state[3])
+        {
+            rng.state_ = state;
+        }
+        return in;
+    }
+
+private:
+    static std::uint64_t rotl(std::uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    std::array<std::uint64_t, 4> state_{};
+};
+
+#if defined(__SIZEOF_INT128__)
+// PCG XSL-RR 128/64 (O'Neill), the generator behind numpy's PCG64.
+class Pcg64
+{
+public:
+    using result_type = std::uint64_t;
+    static constexpr std::string_view name = "pcg64";
+
+    explicit Pcg64(std::uint64_t value = 0)
+    {
+        seed(value);
+    }
+
+    static constexpr result_type min()
+    {
+        return 0;
+    }
+
+    static constexpr result_type max()
+    {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    void seed(std::uint64_t value)
+    {
+        const auto high = splitMix64(value);
+        const auto low = splitMix64(value);
+        const auto streamHigh = splitMix64(value);
+        const auto streamLow = splitMix64(value);
+        increment_ = (static_cast<Word>(streamHigh) << 64 | streamLow) | 1;
+        state_ = 0;
+        step();
+        state_ += static_cast<Word>(high) << 64 | low;
+        step();
+    }
+
+    result_type operator()()
+    {
+        step();
+        const auto folded = static_cast<std::uint64_t>(state_ >> 64) ^ static_cast<std::uint64_t>(state_);
+        const auto rotation = static_cast<int>(state_ >> 122);
+        return (folded >> rotation) | (folded << ((-rotation) & 63));
+    }
+
+    friend std::ostream &operator<<(std::ostream &out, const Pcg64 &rng)
+    {
+        return out << static_cast<std::uint64_t>(rng.state_ >> 64) << ' ' << static_cast<std::uint64_t>(rng.state_)
+                   << ' ' << static_cast<std::uint64_t>(rng.increment_ >> 64) << ' '
+                   << static_cast<std::uint64_t>(rng.increment_);
+    }
+
+    friend std::istream &operator>>(std::istream &in, Pcg64 &rng)
+    {
+        std::array<std::uint64_t, 4> words{};
+        if (in >> words[0] >> words[1] >> words[2] >> words[3])
+        {
+            rng.state_ = static_cast<Word>(words[0]) << 64 | words[1];
+            rng.increment_ = (static_cast<Word>(words[2]) << 64 | words[3]) | 1;
+        }
+        return in;
+    }
+
+private:
+    using Word = unsigned __int128;
+
+    void step()
+    {
+        static const Word multiplier = static_cast<Word>(0x2360ed051fc65da4ULL) << 64 | 0x4385df649fccf645ULL;
+        state_ = state_ * multiplier + increment_;
+    }
+
+    Word state_ = 0;
+    Word increment_ = 1;
+};
+#endif
+
+// Name stored next to the engine state in snapshots, so a snapshot written
+// with one engine is rejected by a manager built on another.
+template <typename Engine>
+constexpr std::string_view engineName()
+{
+    if constexpr (requires { Engine::name; })
+    {
+        return Engine::name;
+    }
+    else if constexpr (std::is_same_v<Engine, std::mt19937>)
+    {
+        return "mt19937";
+    }
+    else
+    {
+        static_assert(std::is_same_v<Engine, std::mt19937_64>, "engine needs a static name");
+        return "mt19937_64";
+    }
+}
+
+inline std::uint64_t randomSeed()
+{
+    std::random_device device;
+    return std::uint64_t{device()} << 32 | device();
+}
+
+// Uniform index in [0, bound) by Lemire's multiply-shift method: one
+// multiplication per draw and, unlike std::uniform_int_distribution, no
+// division unless the rare rejection zone is hit. bound must be non-zero.
+template <typename Rng>
+std::size_t boundedIndex(Rng &rng, std::size_t bound)
+{
+    static_assert(Rng::min() == 0, "engine must produce full-range words");
+    if constexpr (Rng::max() == std::numeric_limits<std::uint32_t>::max())
+    {
+        if (bound <= std::numeric_limits<std::uint32_t>::max())
+        {
+            const auto range = static_cast<std::uint32_t>(bound);
+            auto product = std::uint64_t{static_cast<std::uint32_t>(rng())} * range;
+            if (static_cast<std::uint32_t>(product) < range)
+            {
+                const auto threshold = static_cast<std::uint32_t>(-range) % range;
+                while (static_cast<std::uint32_t>(product) < threshold)
+                {
+                    product = std::uint64_t{static_cast<std::uint32_t>(rng())} * range;
+                }
+            }
+            return static_cast<std::size_t>(product >> 32);
+        }
+    }
+#if defined(__SIZEOF_INT128__)
+    else if constexpr (Rng::max() == std::numeric_limits<std::uint64_t>::max())
+    {
+        using Wide = unsigned __int128;
+        const auto range = static_cast<std::uint64_t>(bound);
+        auto product = static_cast<Wide>(static_cast<std::uint64_t>(rng())) * range;
+        if (static_cast<std::uint64_t>(product) < range)
+        {
+            const auto threshold = (0 - range) % range;
+            while (static_cast<std::uint64_t>(product) < threshold)
+            {
+                product = static_cast<Wide>(static_cast<std::uint64_t>(rng())) * range;
+            }
+        }
+        return static_cast<std::size_t>(product >> 64);
+    }
+#endif
+    std::uniform_int_distribution<std::size_t> pick(0, bound - 1);
+    return pick(rng);
+}
+
+// One fairness cycle over a set of student indices, shuffled lazily:
+// order_[0, remaining_) holds the students not yet called this cycle and each
+// draw swaps a random one of them to the end of that range (one Fisher-Yates
+// step per pick). Starting the next cycle just resets remaining_, so the
+// array is allocated once and reused for every cycle.
+//
+// `positions[idx]` is kept at idx's place in the order so members can be
+// found and removed without a scan. Pools that never share a member can
+// share one positions array; it must cover every member index.
+class CyclePool
+{
+public:
+    explicit CyclePool(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : order_(memory)
+    {
+    }
+
+    bool exhausted() const
+    {
+        return remaining_ == 0;
+    }
+
+    bool empty() const
+    {
+        return order_.empty();
+    }
+
+    std::size_t size() const
+    {
+        return order_.size();
+    }
+
+    std::size_t remaining() const
+    {
+        return remaining_;
+    }
+
+    void restart()
+    {
+        remaining_ = order_.size();
+    }
+
+    template <typename Rng>
+    std::size_t draw(Rng &rng, std::span<std::size_t> positions)
+    {
+        swapAt(boundedIndex(rng, remaining_), remaining_ - 1, positions);
+        return order_[--remaining_];
+    }
+
+    // Puts a draw back into the uncalled range.
+    void undraw()
+    {
+        ++remaining_;
+    }
+
+    // New members join the running cycle. A finished cycle is left finished
+    // so that, as before, they are picked up when the next one starts.
+    void add(std::size_t idx, bool joinCycle, std::span<std::size_t> positions)
+    {
+        positions[idx] = order_.size();
+        order_.push_back(idx);
+        if (joinCycle && remaining_)
+        {
+            swapAt(remaining_, order_.size() - 1, positions);
+            ++remaining_;
+        }
+    }
+
+    // Drops a member; the rest of the cycle is unaffected.
+    void remove(std::size_t idx, std::span<std::size_t> positions)
+    {
+        auto pos = positions[idx];
+        if (pos < remaining_)
+        {
+            swapAt(pos, --remaining_, positions);
+            pos = remaining_;
+        }
+        swapAt(pos, order_.size() - 1, positions);
+        order_.pop_back();
+    }
+
+    // Marks `idx` as called this cycle; false if it already was.
+    bool markCalled(std::size_t idx, std::span<std::size_t> positions)
+    {
+        const auto pos = positions[idx];
+        if (pos >= remaining_ || order_[pos] != idx)
+        {
+            return false;
+        }
+        swapAt(pos, --remaining_, positions);
+        return true;
+    }
+
+    std::span<const std::size_t> order() const
+    {
+        return order_;
+    }
+
+    // Restores a saved cycle; `order` must hold every member exactly once.
+    void assign(std::span<const std::size_t> order, std::size_t remaining, std::span<std::size_t> positions)
+    {
+        order_.assign(order.begin(), order.end());
+        remaining_ = std::min(remaining, order_.size());
+        for (std::size_t pos = 0; pos < order_.size(); ++pos)
+        {
+            positions[order_[pos]] = pos;
+        }
+    }
+
+private:
+    void swapAt(std::size_t i, std::size_t j, std::span<std::size_t> positions)
+    {
+        std::swap(order_[i], order_[j]);
+        positions[order_[i]] = i;
+        positions[order_[j]] = j;
+    }
+
+    std::pmr::vector<std::size_t> order_;
+    std::size_t remaining_ = 0;
+};
+
+// Fenwick tree over non-negative weights: point updates, appends and
+// sampling proportionally to weight all cost O(log n).
+class FenwickSampler
+{
+public:
+    std::size_t size() const
+    {
+        return weights_.size();
+    }
+
+    double total() const
+    {
+        return prefix(weights_.size());
+    }
+
+    double weight(std::size_t i) const
+    {
+        return weights_[i];
+    }
+
+    void push_back(double weight)
+    {
+        weights_.push_back(weight);
+        const auto i = weights_.size();
+        tree_.push_back(weight + prefix(i - 1) - prefix(i - (i & (~i + 1))));
+    }
+
+    void set(std::size_t i, double weight)
+    {
+        const auto delta = weight - weights_[i];
+        weights_[i] = weight;
+        for (auto pos = i + 1; pos <= tree_.size(); pos += pos & (~pos + 1))
+        {
+            tree_[pos - 1] += delta;
+        }
+    }
+
+    // Index whose cumulative range contains `target`, for target in [0, total).
+    std::size_t find(double target) const
+    {
+        std::size_t pos = 0;
+        std::size_t step = 1;
+        while (step * 2 <= tree_.size())
+        {
+            step *= 2;
+        }
+        for (; step; step /= 2)
+        {
+            if (pos + step <= tree_.size() && tree_[pos + step - 1] <= target)
+            {
+                target -= tree_[pos + step - 1];
+                pos += step;
+            }
+        }
+        return std::min(pos, tree_.size() - 1);
+    }
+
+private:
+    double prefix(std::size_t count) const
+    {
+        double sum = 0;
+        for (; count; count -= count & (~count + 1))
+        {
+            sum += tree_[count - 1];
+        }
+        return sum;
+    }
+
+    std::vector<double> tree_;
+    std::vector<double> weights_;
+};
+
+// Maps a student's call count and base weight (1 unless set explicitly)
+// to the relative chance of being picked by RosterManager::pickWeighted.
+// Snapshots store a strategy by name and parameter and rebuild it with
+// makeSelectionStrategy; one without a name is not saved.
+class SelectionStrategy
+{
+public:
+    virtual ~SelectionStrategy() = default;
+    virtual double weight(int callCount, double baseWeight) const = 0;
+
+    virtual std::string_view name() const
+    {
+        return {};
+    }
+
+    virtual double parameter() const
+    {
+        return 0;
+    }
+};
+
+// Favors students who have been called less: weight / (1 + calls)^bias.
+class LeastCalledStrategy : public SelectionStrategy
+{
+public:
+    explicit LeastCalledStrategy(double bias = 1.0) : bias_(bias) {}
+
+    double weight(int callCount, double baseWeight) const override
+    {
+        return baseWeight / std::pow(1.0 + callCount, bias_);
+    }
+
+    std::string_view name() const override
+    {
+        return "least-called";
+    }
+
+    double parameter() const override
+    {
+        return bias_;
+    }
+
+private:
+    double bias_;
+};
+
+// Picks proportionally to the per-student weights alone (attendance,
+// participation credit, ...).
+class BaseWeightStrategy : public SelectionStrategy
+{
+public:
+    double weight(int, double baseWeight) const override
+    {
+        return baseWeight;
+    }
+
+    std::string_view name() const override
+    {
+        return "base-weight";
+    }
+};
+
+// The built-in strategy saved as `name`, or nullptr for any other name.
+inline std::unique_ptr<SelectionStrategy> makeSelectionStrategy(std::string_view name, double parameter)
+{
+    if (name == "least-called")
+    {
+        return std::make_unique<LeastCalledStrategy>(parameter);
+    }
+    if (name == "base-weight")
+    {
+        return std::make_unique<BaseWeightStrategy>();
+    }
+    return nullptr;
+}
+
+// Per-pool Fenwick trees kept in sync with the roster's call counts, so a
+// weighted pick never rescans the roster. Has its own engine so weighted
+// picks leave the shuffle sequence of the cycle pools untouched.
+class WeightedSelector
+{
+public:
+    WeightedSelector(std::unique_ptr<SelectionStrategy> strategy, std::uint64_t seed)
+        : strategy_(std::move(strategy)), rng_(seed)
+    {
+    }
+
+    void seed(std::uint64_t value)
+    {
+        rng_.seed(value);
+    }
+
+    // Students must be added in roster index order.
+    void addStudent(std::uint32_t groupId, int callCount, double baseWeight = 1.0)
+    {
+        if (groupId >= groups_.size())
+        {
+            groups_.resize(groupId + 1);
+            members_.resize(groupId + 1);
+        }
+        baseWeights_.push_back(baseWeight);
+        groupIds_.push_back(groupId);
+        positions_.push_back(groups_[groupId].size());
+        const auto weight = strategy_->weight(callCount, baseWeight);
+        global_.push_back(weight);
+        groups_[groupId].push_back(weight);
+        members_[groupId].push_back(baseWeights_.size() - 1);
+    }
+
+    // A removed student keeps its slots at weight 0 until the next rebuild.
+    void removeStudent(std::size_t idx)
+    {
+        global_.set(idx, 0);
+        groups_[groupIds_[idx]].set(positions_[idx], 0);
+    }
+
+    void moveStudent(std::size_t idx, std::uint32_t groupId, int callCount)
+    {
+        groups_[groupIds_[idx]].set(positions_[idx], 0);
+        if (groupId >= groups_.size())
+        {
+            groups_.resize(groupId + 1);
+            members_.resize(groupId + 1);
+        }
+        groupIds_[idx] = groupId;
+        positions_[idx] = groups_[groupId].size();
+        groups_[groupId].push_back(strategy_->weight(callCount, baseWeights_[idx]));
+        members_[groupId].push_back(idx);
+    }
+
+    void update(std::size_t idx, int callCount)
+    {
+        const auto weight = strategy_->weight(callCount, baseWeights_[idx]);
+        global_.set(idx, weight);
+        groups_[groupIds_[idx]].set(positions_[idx], weight);
+    }
+
+    void setBaseWeight(std::size_t idx, double baseWeight, int callCount)
+    {
+        baseWeights_[idx] = baseWeight;
+        update(idx, callCount);
+    }
+
+    double baseWeight(std::size_t idx) const
+    {
+        return baseWeights_[idx];
+    }
+
+    const SelectionStrategy &strategy() const
+    {
+        return *strategy_;
+    }
+
+    std::unique_ptr<SelectionStrategy> releaseStrategy()
+    {
+        return std::move(strategy_);
+    }
+
+    void clear()
+    {
+        baseWeights_.clear();
+        groupIds_.clear();
+        positions_.clear();
+        global_ = {};
+        groups_.clear();
+        members_.clear();
+    }
+
+    std::size_t size() const
+    {
+        return baseWeights_.size();
+    }
+
+    // Student index over the whole roster.
+    std::optional<std::size_t> sample()
+    {
+        return sampleFrom(global_);
+    }
+
+    // Student index within one group.
+    std::optional<std::size_t> sampleGroup(std::uint32_t groupId)
+    {
+        if (groupId >= groups_.size())
+        {
+            return std::nullopt;
+        }
+        const auto position = sampleFrom(groups_[groupId]);
+        if (!position)
+        {
+            return std::nullopt;
+        }
+        return members_[groupId][*position];
+    }
+
+private:
+    std::optional<std::size_t> sampleFrom(const FenwickSampler &tree)
+    {
+        const auto total = tree.total();
+        if (!(total > 0))
+        {
+            return std::nullopt;
+        }
+        std::uniform_real_distribution<double> target(0.0, total);
+        // Rounding can land on a zero-weight neighbour; redraw in that case.
+        for (int attempt = 0; attempt < 8; ++attempt)
+        {
+            const auto pos = tree.find(target(rng_));
+            if (tree.weight(pos) > 0)
+            {
+                return pos;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::unique_ptr<SelectionStrategy> strategy_;
+    std::vector<double> baseWeights_;
+    std::vector<std::uint32_t> groupIds_;
+    std::vector<std::size_t> positions_;
+    FenwickSampler global_;
+    std::vector<FenwickSampler> groups_;
+    std::vector<std::vector<std::size_t>> members_;
+    Xoshiro256StarStar rng_;
+};
+
+// Students ordered most-called first, ties by name, in a tree keyed on
+// (callCount descending, name). A call only queues the student; queued
+// entries are re-keyed when the order is next read, so a pick is O(1) and
+// a report costs its output size plus O(log n) per student called since the
+// previous report. Names are views into the manager's StringTable.
+class CallLeaderboard
+{
+public:
+    explicit CallLeaderboard(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : entries_(memory), slots_(memory), counts_(memory), queued_(memory), stale_(memory)
+    {
+    }
+
+    // Students must be inserted in roster index order.
+    void insert(std::string_view name, int callCount)
+    {
+        slots_.push_back(entries_.insert(Entry{callCount, name, slots_.size()}).first);
+        counts_.push_back(callCount);
+        queued_.push_back(false);
+    }
+
+    void increment(std::size_t idx)
+    {
+        ++counts_[idx];
+        if (!queued_[idx])
+        {
+            queued_[idx] = true;
+            stale_.push_back(idx);
+        }
+    }
+
+    void remove(std::size_t idx)
+    {
+        entries_.erase(slots_[idx]);
+        slots_[idx] = entries_.end();
+    }
+
+    void clear()
+    {
+        entries_.clear();
+        slots_.clear();
+        counts_.clear();
+        queued_.clear();
+        stale_.clear();
+    }
+
+    std::size_t size() const
+    {
+        return entries_.size();
+    }
+
+    // The first `n` students in leaderboard order (0 = all).
+    std::vector<std::size_t> top(std::size_t n)
+    {
+        refresh();
+        n = n ? std::min(n, entries_.size()) : entries_.size();
+        std::vector<std::size_t> result;
+        result.reserve(n);
+        for (auto it = entries_.begin(); result.size() < n; ++it)
+        {
+            result.push_back(it->idx);
+        }
+        return result;
+    }
+
+    // The `n` least-called students, fewest calls first and ties by name.
+    // Walks the count runs from the bottom, entering each at its first name.
+    std::vector<std::size_t> least(std::size_t n)
+    {
+        refresh();
+        n = std::min(n, entries_.size());
+        std::vector<std::size_t> result;
+        result.reserve(n);
+        auto runEnd = entries_.end();
+        while (result.size() < n)
+        {
+            const auto callCount = std::prev(runEnd)->callCount;
+            const auto runStart = entries_.lower_bound(Entry{callCount, std::string_view{}, 0});
+            for (auto it = runStart; it != runEnd && result.size() < n; ++it)
+            {
+                result.push_back(it->idx);
+            }
+            runEnd = runStart;
+        }
+        return result;
+    }
+
+private:
+    struct Entry
+    {
+        int callCount;
+        std::string_view name;
+        std::size_t idx;
+    };
+
+    struct Order
+    {
+        bool operator()(const Entry &lhs, const Entry &rhs) const
+        {
+            if (lhs.callCount != rhs.callCount)
+            {
+                return lhs.callCount > rhs.callCount;
+            }
+            return lhs.name < rhs.name;
+        }
+    };
+
+    // Moves every queued student to the place of their current count.
+    void refresh()
+    {
+        for (const auto idx : stale_)
+        {
+            queued_[idx] = false;
+            if (slots_[idx] == entries_.end())
+            {
+                continue;
+            }
+            auto node = entries_.extract(slots_[idx]);
+            node.value().callCount = counts_[idx];
+            slots_[idx] = entries_.insert(std::move(node)).position;
+        }
+        stale_.clear();
+    }
+
+    using Entries = std::pmr::set<Entry, Order>;
+    Entries entries_;
+    std::pmr::vector<Entries::iterator> slots_;
+    // Counts as of the last call; an entry's own count lags while queued.
+    std::pmr::vector<int> counts_;
+    std::pmr::vector<bool> queued_;
+    std::pmr::vector<std::size_t> stale_;
+};
+
+// The roster as parallel columns, so a scan over one field (every group id,
+// every call count) streams through that field's array and nothing else.
+class StudentColumns
+{
+public:
+    using Id = StringTable::Id;
+
+    explicit StudentColumns(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : nameIds_(memory), groupIds_(memory), callCounts_(memory)
+    {
+    }
+
+    std::size_t size() const
+    {
+        return nameIds_.size();
+    }
+
+    bool empty() const
+    {
+        return nameIds_.empty();
+    }
+
+    void reserve(std::size_t count)
+    {
+        nameIds_.reserve(count);
+        groupIds_.reserve(count);
+        callCounts_.reserve(count);
+    }
+
+    void push_back(Id nameId, Id groupId, int callCount)
+    {
+        nameIds_.push_back(nameId);
+        groupIds_.push_back(groupId);
+        callCounts_.push_back(callCount);
+    }
+
+    Id nameId(std::size_t idx) const
+    {
+        return nameIds_[idx];
+    }
+
+    Id groupId(std::size_t idx) const
+    {
+        return groupIds_[idx];
+    }
+
+    void setGroupId(std::size_t idx, Id groupId)
+    {
+        groupIds_[idx] = groupId;
+    }
+
+    int &callCount(std::size_t idx)
+    {
+        return callCounts_[idx];
+    }
+
+    int callCount(std::size_t idx) const
+    {
+        return callCounts_[idx];
+    }
+
+    std::span<const Id> nameIds() const
+    {
+        return nameIds_;
+    }
+
+    std::span<const Id> groupIds() const
+    {
+        return groupIds_;
+    }
+
+    std::span<const int> callCounts() const
+    {
+        return callCounts_;
+    }
+
+    std::int64_t totalCalls() const
+    {
+        return std::transform_reduce(callCounts_.begin(), callCounts_.end(), std::int64_t{0}, std::plus<>{},
+                                     [](int count) { return static_cast<std::int64_t>(count); });
+    }
+
+private:
+    std::pmr::vector<Id> nameIds_;
+    std::pmr::vector<Id> groupIds_;
+    std::pmr::vector<int> callCounts_;
+};
+
+// system_clock read at the kernel tick (a few milliseconds) instead of to the
+// nanosecond, which costs a fraction of a precise read.
+struct CoarseClock
+{
+    static std::chrono::system_clock::time_point now()
+    {
+#if defined(CLOCK_REALTIME_COARSE)
+        timespec now{};
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec)));
+#else
+        return std::chrono::system_clock::now();
+#endif
+    }
+};
+
+// Locking policies. SharedLocking leaves the choice to the ThreadingMode
+// given at construction; NoLocking turns every mutex into a NullMutex and the
+// manager is single-threaded whatever mode it is given.
+struct SharedLocking
+{
+    static constexpr bool enabled = true;
+    using SharedMutex = ShardedSharedMutex;
+    using Mutex = std::mutex;
+};
+
+struct NoLocking
+{
+    static constexpr bool enabled = false;
+    using SharedMutex = NullMutex;
+    using Mutex = NullMutex;
+};
+
+// Compile-time configuration of BasicRosterManager:
+//   EngineT   any UniformRandomBitGenerator that streams its state as text
+//             and has an engineName (Xoshiro256StarStar, Pcg64, std::mt19937)
+//   ClockT    stamps each call; now() returns a system_clock::time_point
+//   LockingT  SharedLocking or NoLocking
+//   HistoryT  ChunkedHistory; CompactHistory for smaller records kept to the
+//             millisecond; or NullHistory to keep no call log (nor read the
+//             clock)
+//   PoolT     one draw cycle, with CyclePool's interface
+template <typename EngineT = Xoshiro256StarStar, typename ClockT = std::chrono::system_clock,
+          typename LockingT = SharedLocking, template <typename> class HistoryT = ChunkedHistory,
+          typename PoolT = CyclePool>
+struct RosterPolicies
+{
+    using Engine = EngineT;
+    using Clock = ClockT;
+    using Locking = LockingT;
+    template <typename Record>
+    using History = HistoryT<Record>;
+    using Pool = PoolT;
+};
+
+template <typename Policies = RosterPolicies<>>
+class BasicRosterManager
+{
+    using Engine = typename Policies::Engine;
+    using Clock = typename Policies::Clock;
+    using Locking = typename Policies::Locking;
+    using Pool = typename Policies::Pool;
+    using SharedMutex = typename Locking::SharedMutex;
+    using Mutex = typename Locking::Mutex;
+
+public:
+    struct Student
+    {
+        StringTable::Id nameId = 0;
+        StringTable::Id groupId = 0;
+        int callCount = 0;
+    };
+
+    struct CallRecord
+    {
+        StringTable::Id nameId = 0;
+        StringTable::Id groupId = 0;
+        std::chrono::system_clock::time_point timestamp;
+    };
+
+    using TimePoint = std::chrono::system_clock::time_point;
+    using History = typename Policies::template History<CallRecord>;
+    static constexpr bool keepsHistory = History::keepsRecords;
+
+    static_assert(std::is_convertible_v<decltype(Clock::now()), TimePoint>,
+                  "the clock policy must produce system_clock time points");
+
+    struct ImportStats
+    {
+        std::size_t added = 0;
+        std::size_t duplicates = 0;
+        std::size_t malformed = 0;
+    };
+
+    // files[i] is empty when paths[i] could not be opened.
+    struct MultiImportStats
+    {
+        ImportStats total;
+        std::vector<std::optional<ImportStats>> files;
+    };
+
+    // Counts cover the rows read by this sync only. duplicates are new rows
+    // naming a student who was already in that group (or twice in the file).
+    struct SyncStats
+    {
+        std::size_t added = 0;
+        std::size_t removed = 0;
+        std::size_t moved = 0;
+        std::size_t duplicates = 0;
+        std::size_t malformed = 0;
+        // Only the bytes appended since the previous sync were parsed.
+        bool incremental = false;
+    };
+
+    // How evenly calls are spread over a set of students. variance is the
+    // population variance of callCount, so 0 means perfectly fair.
+    struct CallSummary
+    {
+        std::size_t members = 0;
+        int minCalls = 0;
+        int maxCalls = 0;
+        double meanCalls = 0;
+        double variance = 0;
+        // (calls, students) for each call count that some member has, in
+        // ascending order of calls.
+        std::vector<std::pair<int, std::size_t>> histogram;
+    };
+
+    struct GroupReport
+    {
+        std::string group;
+        CallSummary calls;
+    };
+
+    // groups[id] is the group with that id, including emptied groups.
+    struct CallReport
+    {
+        CallSummary overall;
+        std::vector<GroupReport> groups;
+        std::vector<Student> top;
+    };
+
+    // In concurrent mode picks on different groups proceed in parallel and
+    // only roster changes and the reporting calls serialize. The
+    // single-threaded mode skips every lock.
+    //
+    // Roster, pools, history and their indexes allocate from `memory`, which
+    // has to outlive the manager (and be thread-safe in concurrent mode).
+    // Once the containers have grown to their working size, picks do not
+    // allocate at all.
+    explicit BasicRosterManager(ThreadingMode threading = ThreadingMode::singleThreaded,
+                                std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : BasicRosterManager(randomSeed(), threading, memory)
+    {
+    }
+
+    // A fixed seed makes a single-threaded session reproducible: the same
+    // seed and the same sequence of calls give the same picks.
+    explicit BasicRosterManager(std::uint64_t seed, ThreadingMode threading = ThreadingMode::singleThreaded,
+                                std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : memory_(memory), students_(memory), names_(memory), groups_(memory), nameSlots_(memory),
+          groupPools_(memory), globalPool_(memory), globalSlots_(memory), groupSlots_(memory), history_(memory),
+          callsByName_(memory),
+          callsByGroup_(memory), threading_(threading), seed_(seed), rng_(seed), leaderboard_(memory)
+    {
+    }
+
+    // The seed the engines were last started from. Loading a snapshot
+    // restores the engine state itself, so this is only meaningful for
+    // sessions that began from a fresh seed.
+    std::uint64_t seed() const
+    {
+        const auto lock = readLock();
+        return seed_;
+    }
+
+    void reseed(std::uint64_t seed)
+    {
+        const auto lock = writeLock();
+        seed_ = seed;
+        rng_.seed(seed);
+        if (selector_)
+        {
+            selector_->seed(selectorSeed());
+        }
+    }
+
+    bool addStudent(std::string_view name, std::string_view group, bool refreshPools = true)
+    {
+        const auto lock = writeLock();
+        if (!insertStudent(name, group, refreshPools))
+        {
+            return false;
+        }
+        logAdd(refreshPools);
+        checkpointIfDue();
+        return true;
+    }
+
+    // Takes the student out of every pool; their history stays. Other
+    // students keep their indices until removed rows outnumber live ones,
+    // at which point the roster is compacted and renumbered (so removal is
+    // amortized O(1)). Re-adding the name later starts a fresh count.
+    bool removeStudent(std::string_view name)
+    {
+        const auto lock = writeLock();
+        const auto idx = findSlot(name);
+        if (!idx)
+        {
+            return false;
+        }
+        mergeHistoryPartitions();
+        logRoster(walRemove, students_.nameId(*idx), 0);
+        eraseStudent(*idx);
+        checkpointIfDue();
+        return true;
+    }
+
+    // The student keeps their index, count and place in the whole-roster
+    // cycle, and joins the new group's running cycle as a new member would.
+    bool moveStudent(std::string_view name, std::string_view group)
+    {
+        const auto lock = writeLock();
+        const auto idx = findSlot(name);
+        if (!idx || group.empty())
+        {
+            return false;
+        }
+        if (reassignStudent(*idx, internGroup(group)))
+        {
+            logRoster(walMove, students_.nameId(*idx), students_.groupId(*idx));
+            checkpointIfDue();
+        }
+        return true;
+    }
+
+    std::optional<std::size_t> findStudent(std::string_view name) const
+    {
+        const auto lock = readLock();
+        return findSlot(name);
+    }
+
+    std::string_view nameOf(const Student &student) const
+    {
+        const auto lock = readLock();
+        return names_[student.nameId];
+    }
+
+    std::string_view groupOf(const Student &student) const
+    {
+        const auto lock = readLock();
+        return groups_[student.groupId];
+    }
+
+    std::optional<ImportStats> importFromFile(const std::string &path)
+    {
+        const Metrics::Timer timer(metrics_, Metrics::importLatency);
+        const MappedFile file(path);
+        if (!file.isOpen())
+        {
+            return std::nullopt;
+        }
+
+        const auto lock = writeLock();
+        ImportStats stats;
+        importing_ = true;
+        loadFromBuffer(file.view(), stats);
+        importing_ = false;
+        clearPools();
+        checkpointIfLogging();
+        metrics_.add(Metrics::importedRows, stats.added + stats.duplicates + stats.malformed);
+        metrics_.add(Metrics::importedBytes, file.view().size());
+        return stats;
+    }
+
+    // Same roster and counts as importFromFile, as a coroutine: a reader
+    // thread reads `chunkSize` blocks and parses them a few blocks ahead
+    // (blocking when that queue is full), and each step inserts one parsed
+    // block under the lock, so picks never wait behind the whole file. The
+    // new students join at the end, when the cycles restart. With `wakeup`,
+    // a step that finds nothing parsed returns at once and `wakeup` fires
+    // when the next step can do work; without it, such a step blocks.
+    Task<std::optional<ImportStats>> importFromFileAsync(std::string path, std::size_t chunkSize = 64 * 1024,
+                                                         Wakeup *wakeup = nullptr)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+        {
+            co_return std::nullopt;
+        }
+
+        Metrics::StepTimer timer(metrics_, Metrics::importLatency);
+        Wakeup own;
+        auto &ready = wakeup ? *wakeup : own;
+        BoundedQueue<ParsedChunk> parsed(pipelineDepth, ready);
+        std::size_t bytes = 0;
+        std::jthread reader([&](std::stop_token stop)
+                            { bytes = readChunks(file, std::max<std::size_t>(1, chunkSize), parsed, stop); });
+        ImportStats stats;
+        for (bool drained = false; !drained;)
+        {
+            if (const auto chunk = parsed.tryPop(drained))
+            {
+                const auto lock = writeLock();
+                stats.malformed += chunk->malformed;
+                importing_ = true;
+                for (const auto &row : chunk->rows)
+                {
+                    ++(insertStudent(row.name, row.group, false) ? stats.added : stats.duplicates);
+                }
+                importing_ = false;
+                // More blocks may be queued behind this one.
+                ready.notify();
+            }
+            else if (!drained && !wakeup)
+            {
+                own.wait();
+            }
+            if (!drained)
+            {
+                co_await timer.pause();
+            }
+        }
+        reader.join();
+
+        const auto lock = writeLock();
+        clearPools();
+        checkpointIfLogging();
+        metrics_.add(Metrics::importedRows, stats.added + stats.duplicates + stats.malformed);
+        metrics_.add(Metrics::importedBytes, bytes);
+        co_return stats;
+    }
+
+    // Parses the files in parallel on up to `threads` workers (0 = one per
+    // core), then merges them under the lock in path order, so the roster
+    // and every count match a sequential run of importFromFile. Parsed rows
+    // live in a per-worker arena that is released in one go on return.
+    MultiImportStats importFromFiles(const std::vector<std::string> &paths, std::size_t threads = 0)
+    {
+        const Metrics::Timer timer(metrics_, Metrics::importLatency);
+        if (!threads)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        const auto workerCount = std::max<std::size_t>(1, std::min(threads, paths.size()));
+        const auto arenas = std::make_unique<std::pmr::monotonic_buffer_resource[]>(workerCount);
+        std::vector<std::optional<StagedFile>> staged(paths.size());
+        std::atomic<std::size_t> next{0};
+        const auto worker = [&](std::size_t slot)
+        {
+            for (auto i = next.fetch_add(1); i < paths.size(); i = next.fetch_add(1))
+            {
+                stageFile(paths[i], staged[i].emplace(&arenas[slot]));
+            }
+        };
+        std::vector<std::thread> workers;
+        for (std::size_t slot = 1; slot < workerCount; ++slot)
+        {
+            workers.emplace_back(worker, slot);
+        }
+        worker(0);
+        for (auto &thread : workers)
+        {
+            thread.join();
+        }
+
+        MultiImportStats result;
+        result.files.reserve(staged.size());
+        const auto lock = writeLock();
+        std::size_t rows = 0;
+        for (const auto &file : staged)
+        {
+            rows += file->rows.size();
+        }
+        students_.reserve(students_.size() + rows);
+        importing_ = true;
+        for (const auto &entry : staged)
+        {
+            const auto &file = *entry;
+            if (!file.file || !file.file->isOpen())
+            {
+                result.files.emplace_back();
+                continue;
+            }
+            ImportStats stats;
+            stats.malformed = file.malformed;
+            for (const auto &row : file.rows)
+            {
+                ++(insertStudent(row.name, row.group, false) ? stats.added : stats.duplicates);
+            }
+            result.total.added += stats.added;
+            result.total.duplicates += stats.duplicates;
+            result.total.malformed += stats.malformed;
+            result.files.push_back(stats);
+            metrics_.add(Metrics::importedBytes, file.file->view().size());
+        }
+        importing_ = false;
+        metrics_.add(Metrics::importedRows, result.total.added + result.total.duplicates + result.total.malformed);
+        clearPools();
+        checkpointIfLogging();
+        return result;
+    }
+
+    // Makes the roster follow a file that keeps changing: rows new to the
+    // file are added, rows dropped from it are removed and a changed group
+    // moves the student, all without restarting any cycle. If the file only
+    // grew since the last sync of `path`, just the appended bytes are parsed;
+    // otherwise the whole file is diffed against the rows it had last time.
+    // The first sync of a path (and the first after loadSnapshot) has no
+    // previous rows, so it only adds and moves. A student removed by hand
+    // stays removed while the file keeps their row unchanged; dropping the
+    // row and adding it back brings them back.
+    std::optional<SyncStats> syncFromFile(const std::string &path)
+    {
+        const Metrics::Timer timer(metrics_, Metrics::importLatency);
+        const MappedFile file(path);
+        if (!file.isOpen())
+        {
+            return std::nullopt;
+        }
+
+        const auto data = file.view();
+        const auto lock = writeLock();
+        auto &source = syncSources_[path];
+        SyncStats stats;
+        ContentHash hash;
+        std::size_t offset = 0;
+        if (source.synced && data.size() >= source.size && (!source.size || data[source.size - 1] == '\n'))
+        {
+            hash.update(data.substr(0, source.size));
+            stats.incremental = hash.value() == source.hash;
+        }
+        if (stats.incremental)
+        {
+            offset = source.size;
+        }
+        else
+        {
+            hash = {};
+        }
+        hash.update(data.substr(offset));
+
+        mergeHistoryPartitions();
+        if (stats.incremental)
+        {
+            forEachLine(data.substr(offset),
+                        [&](std::string_view line) { syncLine(line, source.rows, nullptr, stats); });
+        }
+        else
+        {
+            std::unordered_map<StringTable::Id, StringTable::Id> rows;
+            rows.reserve(source.rows.size());
+            forEachLine(data, [&](std::string_view line) { syncLine(line, rows, &source.rows, stats); });
+            for (const auto &[nameId, groupId] : source.rows)
+            {
+                if (const auto idx = slotOf(nameId); idx != npos && !rows.contains(nameId))
+                {
+                    logRoster(walRemove, nameId, 0);
+                    eraseStudent(idx);
+                    ++stats.removed;
+                }
+            }
+            source.rows = std::move(rows);
+        }
+        source.synced = true;
+        source.size = data.size();
+        source.hash = hash.value();
+
+        metrics_.add(Metrics::importedRows, stats.added + stats.moved + stats.duplicates + stats.malformed);
+        metrics_.add(Metrics::importedBytes, data.size() - offset);
+        checkpointIfDue();
+        return stats;
+    }
+
+    std::optional<Student> pickRandom(const std::optional<std::string> &group = std::nullopt)
+    {
+        const auto lock = readLock();
+        const auto idx = group ? pickFromGroup(*group) : pickFromGlobal();
+        if (!idx)
+        {
+            return std::nullopt;
+        }
+        return studentAt(*idx);
+    }
+
+    // Copy-free variants of pickRandom; resolve the index with student().
+    std::optional<std::size_t> pickIndex()
+    {
+        const auto lock = readLock();
+        return pickFromGlobal();
+    }
+
+    std::optional<std::size_t> pickIndex(std::string_view group)
+    {
+        const auto lock = readLock();
+        return pickFromGroup(group);
+    }
+
+    // Weighted picks run beside the shuffled cycle: they do not consume the
+    // cycle pools, and the chance of each student comes from the strategy
+    // set with setSelectionStrategy (both return nullopt without one).
+    std::optional<std::size_t> pickWeighted()
+    {
+        const Metrics::Timer timer(metrics_, Metrics::weightedPickLatency);
+        const auto lock = readLock();
+        const auto weightsLock = lockIfConcurrent(weightsMutex_);
+        if (!selector_)
+        {
+            return std::nullopt;
+        }
+        const auto idx = selector_->sample();
+        if (idx)
+        {
+            recordWeightedCall(*idx);
+        }
+        return idx;
+    }
+
+    std::optional<std::size_t> pickWeighted(std::string_view group)
+    {
+        const Metrics::Timer timer(metrics_, Metrics::weightedPickLatency);
+        const auto lock = readLock();
+        const auto groupId = groups_.find(group);
+        const auto weightsLock = lockIfConcurrent(weightsMutex_);
+        if (!selector_ || !groupId)
+        {
+            return std::nullopt;
+        }
+        const auto idx = selector_->sampleGroup(*groupId);
+        if (!idx)
+        {
+            return std::nullopt;
+        }
+        recordWeightedCall(*idx);
+        return idx;
+    }
+
+    // Replaces the weighting used by pickWeighted; nullptr turns weighted
+    // selection (and its per-pick bookkeeping) off. Base weights set so far
+    // are kept.
+    void setSelectionStrategy(std::unique_ptr<SelectionStrategy> strategy)
+    {
+        const auto lock = writeLock();
+        std::vector<double> baseWeights;
+        if (selector_)
+        {
+            for (std::size_t i = 0; i < selector_->size(); ++i)
+            {
+                baseWeights.push_back(selector_->baseWeight(i));
+            }
+        }
+        selector_.reset();
+        if (strategy)
+        {
+            selector_ = std::make_unique<WeightedSelector>(std::move(strategy), selectorSeed());
+            baseWeights.resize(students_.size(), 1.0);
+            fillSelector(baseWeights);
+        }
+        checkpointIfLogging();
+    }
+
+    bool setStudentWeight(std::string_view name, double weight)
+    {
+        const auto lock = writeLock();
+        const auto idx = findSlot(name);
+        if (!idx || !selector_ || !(weight >= 0))
+        {
+            return false;
+        }
+        selector_->setBaseWeight(*idx, weight, students_.callCount(*idx));
+        logRoster(walWeight, students_.nameId(*idx), std::bit_cast<std::int64_t>(weight));
+        return true;
+    }
+
+    // Most picks a batch will make when the pool is smaller; a batch can
+    // always cover one whole cycle of a larger pool.
+    static constexpr std::size_t maxBatchPicks = std::size_t{1} << 20;
+
+    // Equivalent to k consecutive picks: a cycle that runs out mid-batch is
+    // restarted, so repeats only happen across a cycle boundary. k is capped
+    // at max(pool size, maxBatchPicks).
+    std::vector<std::size_t> pickBatch(std::size_t k, std::optional<std::string_view> group = std::nullopt)
+    {
+        const Metrics::Timer timer(metrics_, Metrics::batchPickLatency);
+        const auto lock = readLock();
+        std::vector<std::size_t> picked;
+        Pool *pool = &globalPool_;
+        Mutex *poolMutex = &globalPoolMutex_;
+        std::optional<StringTable::Id> groupId;
+        if (group)
+        {
+            groupId = groups_.find(*group);
+            if (!groupId)
+            {
+                return picked;
+            }
+            pool = &groupPools_[*groupId];
+            poolMutex = &groupPoolMutex(*groupId);
+        }
+
+        auto poolLock = lockIfConcurrent(*poolMutex);
+        if (pool->empty())
+        {
+            return picked;
+        }
+        k = std::min(k, std::max(pool->size(), maxBatchPicks));
+        picked.reserve(k);
+        auto &rng = engine();
+        const auto slots = poolSlots(groupId ? *groupId : walGlobalPool);
+        while (picked.size() < k)
+        {
+            if (pool->exhausted())
+            {
+                pool->restart();
+                metrics_.add(groupId ? Metrics::groupRestarts : Metrics::globalRestarts);
+            }
+            picked.push_back(pool->draw(rng, slots));
+        }
+        poolLock = {};
+        metrics_.add(groupId ? Metrics::groupPicks : Metrics::globalPicks, picked.size());
+
+        const auto time = now();
+        std::array<std::byte, 4096> scratch;
+        std::pmr::monotonic_buffer_resource arena(scratch.data(), scratch.size(), memory_);
+        std::pmr::vector<CallRecord> records(&arena);
+        records.reserve(picked.size());
+        for (const auto idx : picked)
+        {
+            bumpCount(idx);
+            records.push_back(CallRecord{students_.nameId(idx), students_.groupId(idx), time});
+        }
+        appendHistory(records.data(), records.size());
+        logCalls(records.data(), records.size(), groupId ? *groupId : walGlobalPool);
+        return picked;
+    }
+
+    // A snapshot of one roster row; callCount is read at the time of the call.
+    Student student(std::size_t idx) const
+    {
+        const auto lock = readLock();
+        return studentAt(idx);
+    }
+
+    std::string_view nameOf(const CallRecord &record) const
+    {
+        const auto lock = readLock();
+        return names_[record.nameId];
+    }
+
+    std::string_view groupOf(const CallRecord &record) const
+    {
+        const auto lock = readLock();
+        return groups_[record.groupId];
+    }
+
+    // Students on the roster now. Indices run up to rowCount(), which also
+    // counts removed students whose rows have not been compacted yet.
+    std::size_t studentCount() const
+    {
+        const auto lock = readLock();
+        return liveCount();
+    }
+
+    std::size_t rowCount() const
+    {
+        const auto lock = readLock();
+        return students_.size();
+    }
+
+    std::size_t groupCount() const
+    {
+        const auto lock = readLock();
+        return groups_.size();
+    }
+
+    // Sum of every callCount; a single pass over the count column.
+    std::int64_t totalCalls() const
+    {
+        const auto lock = writeLock();
+        return students_.totalCalls();
+    }
+
+    std::size_t historySize() const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        return history_.size();
+    }
+
+    // Calls fn(record) for the newest `limit` records (0 = all), newest
+    // first. fn must not call back into the manager.
+    template <typename Fn>
+    void forEachRecent(std::size_t limit, Fn &&fn) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        const auto count = limit ? std::min(limit, history_.size()) : history_.size();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const CallRecord &record = history_.fromBack(i);
+            fn(record);
+        }
+    }
+
+    // Time-range queries, oldest first, over calls with from <= timestamp <
+    // to. They binary-search the history, which is in timestamp order as
+    // long as the wall clock is not stepped back.
+    std::vector<CallRecord> callsBetween(TimePoint from, TimePoint to) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        const auto timeOf = [this](std::size_t i) { return history_[i].timestamp; };
+        const auto all = std::views::iota(std::size_t{0}, history_.size());
+        const auto begin = std::ranges::partition_point(all, [from](TimePoint t) { return t < from; }, timeOf);
+        const auto end = std::ranges::partition_point(
+            std::ranges::subrange(begin, all.end()), [to](TimePoint t) { return t < to; }, timeOf);
+        std::vector<CallRecord> records;
+        records.reserve(static_cast<std::size_t>(end - begin));
+        for (auto it = begin; it != end; ++it)
+        {
+            records.push_back(history_[*it]);
+        }
+        return records;
+    }
+
+    std::vector<CallRecord> callsFor(std::string_view name, TimePoint from = TimePoint::min(),
+                                     TimePoint to = TimePoint::max()) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        const auto nameId = names_.find(name);
+        return nameId ? collectCalls(callsByName_.find(*nameId, history_.firstSequence()), from, to)
+                      : std::vector<CallRecord>{};
+    }
+
+    std::vector<CallRecord> callsForGroup(std::string_view group, TimePoint from = TimePoint::min(),
+                                          TimePoint to = TimePoint::max()) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        const auto groupId = groups_.find(group);
+        return groupId ? collectCalls(callsByGroup_.find(*groupId, history_.firstSequence()), from, to)
+                       : std::vector<CallRecord>{};
+    }
+
+    // Off by default. Once on, picks and imports record counters and
+    // latencies; see Metrics.
+    void enableMetrics(bool enabled = true)
+    {
+        const auto lock = writeLock();
+        metrics_.setEnabled(enabled);
+    }
+
+    MetricsReport metricsReport() const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        MetricsReport report;
+        report.sample = metrics_.read();
+        report.students = liveCount();
+        report.groups = groups_.size();
+        report.historyRecords = history_.size();
+        report.historyBytes = history_.memoryBytes() +
+                              (callsByName_.size() + callsByGroup_.size()) * sizeof(std::uint64_t);
+        report.nameLoadFactor = names_.loadFactor();
+        report.groupLoadFactor = groups_.loadFactor();
+        return report;
+    }
+
+    void exportMetrics(OutputBuffer &out, MetricsFormat format) const
+    {
+        writeMetrics(out, format, {{std::string{}, metricsReport()}});
+    }
+
+    bool exportMetrics(const std::string &path, MetricsFormat format) const
+    {
+        return exportToFile(path, [&](OutputBuffer &out) { exportMetrics(out, format); });
+    }
+
+    // Indices of the `n` most-called students, in printStats order.
+    std::vector<std::size_t> topCalled(std::size_t n) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        return n ? leaderboard_.top(n) : std::vector<std::size_t>{};
+    }
+
+    // Indices of the `n` least-called students, fewest calls first.
+    std::vector<std::size_t> leastCalled(std::size_t n) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        return leaderboard_.least(n);
+    }
+
+    void printHistory(std::size_t limit = 0) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        if (history_.empty())
+        {
+            std::cout << "No history yet\n";
+            return;
+        }
+
+        OutputBuffer out(OutputBuffer::streamSink(std::cout));
+        TimestampFormatter timestamps;
+        const auto count = limit ? std::min(limit, history_.size()) : history_.size();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const auto &record = history_.fromBack(i);
+            out.append(timestamps.format(record.timestamp));
+            out.append(" - ");
+            out.append(groups_[record.groupId]);
+            out.append(" - ");
+            out.append(names_[record.nameId]);
+            out.push_back('\n');
+        }
+        out.flush();
+    }
+
+    void printStats() const
+    {
+        const auto lock = writeLock();
+        if (!liveCount())
+        {
+            std::cout << "No student data\n";
+            return;
+        }
+
+        mergeHistoryPartitions();
+        OutputBuffer out(OutputBuffer::streamSink(std::cout));
+        out.appendPadded("Name", 20);
+        out.appendPadded("Group", 15);
+        out.append("Count\n");
+        for (const auto idx : leaderboard_.top(0))
+        {
+            out.appendPadded(names_[students_.nameId(idx)], 20);
+            out.appendPadded(groups_[students_.groupId(idx)], 15);
+            out.appendNumber(students_.callCount(idx));
+            out.push_back('\n');
+        }
+        out.flush();
+    }
+
+    void listGroups() const
+    {
+        const auto lock = writeLock();
+        if (!liveCount())
+        {
+            std::cout << "No group data\n";
+            return;
+        }
+
+        OutputBuffer out(OutputBuffer::streamSink(std::cout));
+        out.append("Groups:\n");
+        for (StringTable::Id id = 0; id < groups_.size(); ++id)
+        {
+            out.append("- ");
+            out.append(groups_[id]);
+            out.append(" (");
+            out.appendNumber(groupPools_[id].size());
+            out.append(")\n");
+        }
+        out.flush();
+    }
+
+    // Parallel pass over the call-count column: per-group and overall
+    // spread of callCount plus the `top` most-called students. Each of up to
+    // `threads` workers (0 = one per core) reduces a slice of the roster into
+    // its own partials, which are merged in slice order.
+    CallReport callReport(std::size_t top = 10, std::size_t threads = 0) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        if (!threads)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        const auto rows = students_.size();
+        const auto groupCount = groups_.size();
+        const auto workerCount = std::clamp<std::size_t>(rows / minRowsPerWorker, 1, threads);
+        const auto live = [this](std::size_t idx) { return nameSlots_[students_.nameId(idx)] == idx; };
+
+        std::vector<std::vector<CallAccumulator>> partials(workerCount, std::vector<CallAccumulator>(groupCount));
+        forEachSlice(rows, workerCount,
+                     [&](std::size_t worker, std::size_t first, std::size_t last)
+                     {
+                         auto &groups = partials[worker];
+                         for (auto idx = first; idx < last; ++idx)
+                         {
+                             if (live(idx))
+                             {
+                                 groups[students_.groupId(idx)].add(students_.callCount(idx));
+                             }
+                         }
+                     });
+        std::vector<CallAccumulator> totals(groupCount);
+        CallAccumulator overall;
+        for (StringTable::Id id = 0; id < groupCount; ++id)
+        {
+            for (const auto &groups : partials)
+            {
+                totals[id].merge(groups[id]);
+            }
+            overall.merge(totals[id]);
+        }
+
+        // Second pass. A group whose calls span no more values than it has
+        // members counts into a plain array offset by its minimum; any other
+        // group has its (group, calls) keys sorted into runs, so no histogram
+        // grows with the distance between the minimum and the maximum.
+        const auto spread = [](const CallAccumulator &calls)
+        { return static_cast<std::size_t>(static_cast<std::int64_t>(calls.max) - calls.min) + 1; };
+        std::vector<std::size_t> denseSpread(groupCount, 0);
+        for (StringTable::Id id = 0; id < groupCount; ++id)
+        {
+            if (totals[id].count && spread(totals[id]) <= totals[id].count)
+            {
+                denseSpread[id] = spread(totals[id]);
+            }
+        }
+        using Key = std::pair<StringTable::Id, int>;
+        std::vector<std::vector<std::vector<std::size_t>>> counts(workerCount);
+        std::vector<std::vector<std::pair<Key, std::size_t>>> runs(workerCount);
+        forEachSlice(rows, workerCount,
+                     [&](std::size_t worker, std::size_t first, std::size_t last)
+                     {
+                         auto &histograms = counts[worker];
+                         histograms.resize(groupCount);
+                         for (StringTable::Id id = 0; id < groupCount; ++id)
+                         {
+                             histograms[id].assign(denseSpread[id], 0);
+                         }
+                         std::vector<Key> keys;
+                         for (auto idx = first; idx < last; ++idx)
+                         {
+                             if (!live(idx))
+                             {
+                                 continue;
+                             }
+                             const auto id = students_.groupId(idx);
+                             if (denseSpread[id])
+                             {
+                                 ++histograms[id][static_cast<std::size_t>(students_.callCount(idx) - totals[id].min)];
+                             }
+                             else
+                             {
+                                 keys.emplace_back(id, students_.callCount(idx));
+                             }
+                         }
+                         std::sort(keys.begin(), keys.end());
+                         auto &slice = runs[worker];
+                         for (const auto &key : keys)
+                         {
+                             if (slice.empty() || slice.back().first != key)
+                             {
+                                 slice.emplace_back(key, 0);
+                             }
+                             ++slice.back().second;
+                         }
+                     });
+        std::vector<std::pair<Key, std::size_t>> merged;
+        for (const auto &slice : runs)
+        {
+            merged.insert(merged.end(), slice.begin(), slice.end());
+        }
+        std::sort(merged.begin(), merged.end());
+
+        const auto addRun = [](std::vector<std::pair<int, std::size_t>> &histogram, int calls, std::size_t students)
+        {
+            if (histogram.empty() || histogram.back().first != calls)
+            {
+                histogram.emplace_back(calls, 0);
+            }
+            histogram.back().second += students;
+        };
+        CallReport report;
+        report.overall = overall.summary();
+        report.groups.reserve(groupCount);
+        for (StringTable::Id id = 0; id < groupCount; ++id)
+        {
+            auto &group = report.groups.emplace_back(GroupReport{std::string(groups_[id]), totals[id].summary()});
+            for (std::size_t i = 0; i < denseSpread[id]; ++i)
+            {
+                std::size_t students = 0;
+                for (const auto &histograms : counts)
+                {
+                    students += histograms[id][i];
+                }
+                if (students)
+                {
+                    group.calls.histogram.emplace_back(totals[id].min + static_cast<int>(i), students);
+                }
+            }
+        }
+        for (const auto &[key, students] : merged)
+        {
+            addRun(report.groups[key.first].calls.histogram, key.second, students);
+        }
+        std::vector<std::pair<int, std::size_t>> everyone;
+        for (const auto &group : report.groups)
+        {
+            everyone.insert(everyone.end(), group.calls.histogram.begin(), group.calls.histogram.end());
+        }
+        std::sort(everyone.begin(), everyone.end());
+        for (const auto &[calls, students] : everyone)
+        {
+            addRun(report.overall.histogram, calls, students);
+        }
+        if (top)
+        {
+            for (const auto idx : leaderboard_.top(top))
+            {
+                report.top.push_back(studentAt(idx));
+            }
+        }
+        return report;
+    }
+
+    // callReport as tables: the roster's spread, one line per group, then
+    // the most-called students.
+    void printCallReport(std::size_t top = 10, std::size_t threads = 0) const
+    {
+        const auto report = callReport(top, threads);
+        if (!report.overall.members)
+        {
+            std::cout << "No student data\n";
+            return;
+        }
+
+        OutputBuffer out(OutputBuffer::streamSink(std::cout));
+        const auto appendFixed = [&out](double value, std::size_t width)
+        {
+            std::array<char, 32> digits;
+            const auto end =
+                std::to_chars(digits.data(), digits.data() + digits.size(), value, std::chars_format::fixed, 2).ptr;
+            out.appendPadded({digits.data(), static_cast<std::size_t>(end - digits.data())}, width);
+        };
+        const auto appendLine = [&](std::string_view label, const CallSummary &calls)
+        {
+            out.appendPadded(label, 15);
+            out.appendPadded(std::to_string(calls.members), 10);
+            out.appendPadded(std::to_string(calls.minCalls), 6);
+            out.appendPadded(std::to_string(calls.maxCalls), 6);
+            appendFixed(calls.meanCalls, 10);
+            appendFixed(calls.variance, 0);
+            out.push_back('\n');
+        };
+        out.appendPadded("Group", 15);
+        out.appendPadded("Members", 10);
+        out.appendPadded("Min", 6);
+        out.appendPadded("Max", 6);
+        out.appendPadded("Mean", 10);
+        out.append("Variance\n");
+        appendLine("(all)", report.overall);
+        for (const auto &group : report.groups)
+        {
+            if (group.calls.members)
+            {
+                appendLine(group.group, group.calls);
+            }
+        }
+        if (!report.top.empty())
+        {
+            out.append("\nMost called:\n");
+            for (const auto &student : report.top)
+            {
+                out.appendPadded(nameOf(student), 20);
+                out.appendPadded(groupOf(student), 15);
+                out.appendNumber(student.callCount);
+                out.push_back('\n');
+            }
+        }
+        out.flush();
+    }
+
+    // Bulk exports. CSV and JSON Lines carry local "YYYY-MM-DD HH:MM:SS"
+    // times; the binary form is native-endian and stores nanoseconds since
+    // the epoch. The OutputBuffer overloads leave the final flush (and so
+    // the error check) to the caller; the path overloads replace the file.
+    // History exports the newest `limit` records (0 = all), oldest first.
+    void exportHistory(OutputBuffer &out, ExportFormat format, std::size_t limit = 0) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        const auto count = limit ? std::min(limit, history_.size()) : history_.size();
+        TimestampFormatter timestamps;
+        beginExport(out, format, "time,group,name\n", count);
+        for (auto i = history_.size() - count; i < history_.size(); ++i)
+        {
+            appendHistoryRecord(out, format, history_[i], timestamps);
+        }
+    }
+
+    bool exportHistory(const std::string &path, ExportFormat format, std::size_t limit = 0) const
+    {
+        return exportToFile(path, [&](OutputBuffer &out) { exportHistory(out, format, limit); });
+    }
+
+    // Writes the same bytes as exportHistory(path, ...), as a coroutine:
+    // each step formats up to `batchRecords` records under the lock and
+    // hands them to a writer thread, suspending while it is behind. The
+    // export covers the records that existed when it started; any of them
+    // dropped from history before their step are left out. `wakeup` works
+    // as for importFromFileAsync.
+    Task<bool> exportHistoryAsync(std::string path, ExportFormat format, std::size_t limit = 0,
+                                  std::size_t batchRecords = 4096, Wakeup *wakeup = nullptr)
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            co_return false;
+        }
+
+        std::string chunk;
+        OutputBuffer out([&chunk](std::string_view data)
+                         {
+                             chunk.append(data);
+                             return true;
+                         });
+        std::uint64_t next = 0;
+        std::uint64_t end = 0;
+        std::size_t count = 0;
+        {
+            const auto lock = writeLock();
+            mergeHistoryPartitions();
+            count = limit ? std::min(limit, history_.size()) : history_.size();
+            end = history_.nextSequence();
+            next = end - count;
+        }
+        beginExport(out, format, "time,group,name\n", count);
+
+        Wakeup own;
+        auto &ready = wakeup ? *wakeup : own;
+        BoundedQueue<std::string> pending(pipelineDepth, ready);
+        bool written = true;
+        std::atomic<bool> finished{false};
+        std::jthread writer(
+            [&](std::stop_token stop)
+            {
+                while (auto data = pending.pop(stop))
+                {
+                    written = written && file.write(data->data(), static_cast<std::streamsize>(data->size()));
+                }
+                finished = true;
+                ready.notify();
+            });
+        // Returns once the writer may have moved on, or at once with `wakeup`.
+        const auto waitForWriter = [&]
+        {
+            if (!wakeup)
+            {
+                own.wait();
+            }
+        };
+        TimestampFormatter timestamps;
+        std::size_t rows = 0;
+        while (true)
+        {
+            if (next < end)
+            {
+                const auto lock = writeLock();
+                mergeHistoryPartitions();
+                next = std::max(next, history_.firstSequence());
+                const auto stop = std::min(end, next + std::max<std::size_t>(1, batchRecords));
+                for (; next < stop; ++next, ++rows)
+                {
+                    appendHistoryRecord(out, format, history_[next - history_.firstSequence()], timestamps);
+                }
+            }
+            out.flush();
+            while (!chunk.empty() && !pending.tryPush(chunk))
+            {
+                waitForWriter();
+                co_await std::suspend_always{};
+            }
+            chunk.clear();
+            if (next >= end)
+            {
+                break;
+            }
+            ready.notify();
+            co_await std::suspend_always{};
+        }
+        pending.close();
+        while (!finished)
+        {
+            waitForWriter();
+            co_await std::suspend_always{};
+        }
+        writer.join();
+
+        // Records dropped mid-export leave the binary header's count too high.
+        if (format == ExportFormat::binary && rows != count && written)
+        {
+            const auto actual = static_cast<std::uint64_t>(rows);
+            file.seekp(binaryCountOffset);
+            file.write(reinterpret_cast<const char *>(&actual), sizeof(actual));
+        }
+        co_return written && file.flush();
+    }
+
+    // Students in printStats order.
+    void exportStats(OutputBuffer &out, ExportFormat format) const
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        beginExport(out, format, "name,group,count\n", liveCount());
+        for (const auto idx : leaderboard_.top(0))
+        {
+            const auto name = names_[students_.nameId(idx)];
+            const auto group = groups_[students_.groupId(idx)];
+            if (format == ExportFormat::binary)
+            {
+                out.putString(name);
+                out.putString(group);
+                out.put(static_cast<std::int32_t>(students_.callCount(idx)));
+                continue;
+            }
+            std::array<char, 16> digits;
+            const auto end =
+                std::to_chars(digits.data(), digits.data() + digits.size(), students_.callCount(idx)).ptr;
+            const std::array<ExportField, 3> fields{
+                {{"name", name, false},
+                 {"group", group, false},
+                 {"count", {digits.data(), static_cast<std::size_t>(end - digits.data())}, true}}};
+            appendRow(out, format, fields);
+        }
+    }
+
+    bool exportStats(const std::string &path, ExportFormat format) const
+    {
+        return exportToFile(path, [&](OutputBuffer &out) { exportStats(out, format); });
+    }
+
+    void exportGroups(OutputBuffer &out, ExportFormat format) const
+    {
+        const auto lock = writeLock();
+        beginExport(out, format, "group,members\n", groups_.size());
+        for (StringTable::Id id = 0; id < groups_.size(); ++id)
+        {
+            if (format == ExportFormat::binary)
+            {
+                out.putString(groups_[id]);
+                out.put(static_cast<std::uint64_t>(groupPools_[id].size()));
+                continue;
+            }
+            std::array<char, 24> digits;
+            const auto end = std::to_chars(digits.data(), digits.data() + digits.size(), groupPools_[id].size()).ptr;
+            const std::array<ExportField, 2> fields{
+                {{"group", groups_[id], false},
+                 {"members", {digits.data(), static_cast<std::size_t>(end - digits.data())}, true}}};
+            appendRow(out, format, fields);
+        }
+    }
+
+    bool exportGroups(const std::string &path, ExportFormat format) const
+    {
+        return exportToFile(path, [&](OutputBuffer &out) { exportGroups(out, format); });
+    }
+
+    void resetCycle()
+    {
+        const auto lock = writeLock();
+        clearPools();
+        checkpointIfLogging();
+    }
+
+    void clearHistory()
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        clearStoredHistory();
+        checkpointIfLogging();
+    }
+
+    // Keeps at most `limit` records in memory (0 = unlimited). When
+    // `spillPath` is given, evicted records are appended to it as
+    // "time,group,name" lines instead of being dropped. The lines are
+    // buffered and flushed before every snapshot and when the manager is
+    // destroyed, but not fsynced: a crash can lose the lines written since
+    // the last snapshot.
+    bool setHistoryRetention(std::size_t limit, const std::string &spillPath = {})
+    {
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        spill_.close();
+        history_.setEvictionHandler(nullptr);
+        if (!spillPath.empty())
+        {
+            spill_.open(spillPath, std::ios::app);
+            if (!spill_.is_open())
+            {
+                return false;
+            }
+            history_.setEvictionHandler([this](const CallRecord *records, std::size_t count)
+                                        { spillRecords(records, count); });
+        }
+        retainHistory(limit);
+        return true;
+    }
+
+    // Persists the complete state (roster, counters, cycle positions, RNG
+    // and history) so a restart resumes exactly where it left off.
+    bool saveSnapshot(const std::string &path) const
+    {
+        const auto lock = writeLock();
+        return writeSnapshot(path);
+    }
+
+    // Replaces the current state with the snapshot at `path`. Leaves the
+    // manager untouched when the file is missing, truncated or from a
+    // different format version.
+    bool loadSnapshot(const std::string &path)
+    {
+        const MappedFile file(path);
+        if (!file.isOpen())
+        {
+            return false;
+        }
+        const auto lock = writeLock();
+        mergeHistoryPartitions();
+        return readSnapshot(file.view());
+    }
+
+    // Replays `walPath` on top of the current state (normally right after
+    // loadSnapshot), checkpoints the result into `snapshotPath` and starts
+    // logging every pick, add, removal and move to a fresh log. Changes the
+    // log cannot express (imports, cycle resets, history clears) checkpoint
+    // again, as does a roster change once the log reaches
+    // options.checkpointRecords. Returns the number of replayed picks.
+    std::optional<std::size_t> openWal(const std::string &walPath, const std::string &snapshotPath,
+                                       WalOptions options = {})
+    {
+        const auto lock = writeLock();
+        const auto walLock = lockIfConcurrent(walMutex_);
+        mergeHistoryPartitions();
+        wal_.close();
+        std::size_t replayed = 0;
+        std::string text;
+        const bool valid = WriteAheadLog<WalRecord>::replay(
+            walPath, [&](std::uint64_t sequence, const WalRecord &record)
+            {
+                if (sequence < walSequence_)
+                {
+                    return;
+                }
+                walSequence_ = sequence + 1;
+                if (record.poolId == walText)
+                {
+                    const auto bytes = std::min<std::size_t>(record.nameId, walTextBytes);
+                    text.append(reinterpret_cast<const char *>(&record.timestamp), bytes);
+                }
+                else if (record.poolId >= walWeight && record.poolId <= walAdd)
+                {
+                    replayRosterChange(record, text);
+                    text.clear();
+                }
+                else if (replayCall(record))
+                {
+                    ++replayed;
+                } });
+        if (!valid || !writeSnapshot(snapshotPath) || !wal_.create(walPath, walSequence_, options))
+        {
+            return std::nullopt;
+        }
+        walPath_ = walPath;
+        snapshotPath_ = snapshotPath;
+        walOptions_ = options;
+        walBaseSequence_ = walSequence_;
+        return replayed;
+    }
+
+    // Writes a snapshot and truncates the log; everything logged so far is
+    // covered by the snapshot's sequence number.
+    bool checkpoint()
+    {
+        const auto lock = writeLock();
+        return checkpointLocked();
+    }
+
+    void flushWal()
+    {
+        const auto lock = lockIfConcurrent(walMutex_);
+        wal_.flush();
+    }
+
+private:
+    struct ExportField
+    {
+        std::string_view key;
+        std::string_view value;
+        bool numeric;
+    };
+
+    template <typename Write>
+    static bool exportToFile(const std::string &path, Write write)
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        OutputBuffer out(OutputBuffer::streamSink(file));
+        write(out);
+        return out.flush() && file.flush();
+    }
+
+    void appendHistoryRecord(OutputBuffer &out, ExportFormat format, const CallRecord &record,
+                             TimestampFormatter &timestamps) const
+    {
+        if (format == ExportFormat::binary)
+        {
+            out.put(static_cast<std::int64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(record.timestamp.time_since_epoch()).count()));
+            out.putString(groups_[record.groupId]);
+            out.putString(names_[record.nameId]);
+            return;
+        }
+        const auto time = timestamps.format(record.timestamp);
+        const std::array<ExportField, 3> fields{{{"time", time, false},
+                                                 {"group", groups_[record.groupId], false},
+                                                 {"name", names_[record.nameId], false}}};
+        appendRow(out, format, fields);
+    }
+
+    // CSV gets its header line; binary gets a small header and the row
+    // count; JSON Lines needs neither.
+    static void beginExport(OutputBuffer &out, ExportFormat format, std::string_view csvHeader, std::size_t rows)
+    {
+        if (format == ExportFormat::csv)
+        {
+            out.append(csvHeader);
+        }
+        else if (format == ExportFormat::binary)
+        {
+            out.put(exportMagic);
+            out.put(exportVersion);
+            out.put(snapshotByteOrder);
+            out.put(static_cast<std::uint64_t>(rows));
+        }
+    }
+
+    template <std::size_t N>
+    static void appendRow(OutputBuffer &out, ExportFormat format, const std::array<ExportField, N> &fields)
+    {
+        if (format == ExportFormat::jsonLines)
+        {
+            out.push_back('{');
+        }
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            const auto &field = fields[i];
+            if (format == ExportFormat::csv)
+            {
+                if (i)
+                {
+                    out.push_back(',');
+                }
+                appendCsvField(out, field.value);
+                continue;
+            }
+            if (i)
+            {
+                out.push_back(',');
+            }
+            appendJsonString(out, field.key);
+            out.push_back(':');
+            if (field.numeric)
+            {
+                out.append(field.value);
+            }
+            else
+            {
+                appendJsonString(out, field.value);
+            }
+        }
+        if (format == ExportFormat::jsonLines)
+        {
+            out.push_back('}');
+        }
+        out.push_back('\n');
+    }
+
+    static void appendCsvField(OutputBuffer &out, std::string_view value)
+    {
+        if (value.find_first_of(",\"\r\n") == std::string_view::npos)
+        {
+            out.append(value);
+            return;
+        }
+        out.push_back('"');
+        for (const auto c : value)
+        {
+            if (c == '"')
+            {
+                out.push_back('"');
+            }
+            out.push_back(c);
+        }
+        out.push_back('"');
+    }
+
+    static void appendJsonString(OutputBuffer &out, std::string_view value)
+    {
+        static constexpr char hex[] = "0123456789abcdef";
+        out.push_back('"');
+        for (const auto c : value)
+        {
+            const auto byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\')
+            {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if (byte < 0x20)
+            {
+                out.append("\\u00");
+                out.push_back(hex[byte >> 4]);
+                out.push_back(hex[byte & 0xf]);
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+        out.push_back('"');
+    }
+
+    struct WalRecord
+    {
+        StringTable::Id nameId;
+        StringTable::Id poolId;
+        std::int64_t timestamp;
+    };
+
+    struct RosterRow
+    {
+        std::string_view name;
+        std::string_view group;
+    };
+
+    enum class LineKind
+    {
+        blank,
+        malformed,
+        row
+    };
+
+    // What a synced file held last time: its length, the hash of those
+    // bytes and every row by name (first occurrence wins, as on import).
+    struct SyncSource
+    {
+        bool synced = false;
+        std::size_t size = 0;
+        std::uint64_t hash = 0;
+        std::unordered_map<StringTable::Id, StringTable::Id> rows;
+    };
+
+    struct StagedFile
+    {
+        explicit StagedFile(std::pmr::memory_resource *memory) : rows(memory)
+        {
+        }
+
+        std::optional<MappedFile> file;
+        std::pmr::vector<RosterRow> rows;
+        std::size_t malformed = 0;
+    };
+
+    // Count, extremes, mean and sum of squared deviations of call counts.
+    // Partials from separate slices merge exactly (Chan et al.).
+    struct CallAccumulator
+    {
+        std::size_t count = 0;
+        int min = std::numeric_limits<int>::max();
+        int max = std::numeric_limits<int>::min();
+        double mean = 0;
+        double m2 = 0;
+
+        void add(int value)
+        {
+            ++count;
+            min = std::min(min, value);
+            max = std::max(max, value);
+            const auto delta = value - mean;
+            mean += delta / static_cast<double>(count);
+            m2 += delta * (value - mean);
+        }
+
+        void merge(const CallAccumulator &other)
+        {
+            if (!other.count)
+            {
+                return;
+            }
+            const auto total = static_cast<double>(count + other.count);
+            const auto delta = other.mean - mean;
+            mean += delta * static_cast<double>(other.count) / total;
+            m2 += other.m2 + delta * delta * static_cast<double>(count) * static_cast<double>(other.count) / total;
+            count += other.count;
+            min = std::min(min, other.min);
+            max = std::max(max, other.max);
+        }
+
+        CallSummary summary() const
+        {
+            CallSummary calls;
+            if (count)
+            {
+                calls.members = count;
+                calls.minCalls = min;
+                calls.maxCalls = max;
+                calls.meanCalls = mean;
+                calls.variance = m2 / static_cast<double>(count);
+            }
+            return calls;
+        }
+    };
+
+    // A block of whole lines and the rows parsed from it. The text is a
+    // vector so the rows' views survive moving the chunk through a queue.
+    struct ParsedChunk
+    {
+        std::vector<char> text;
+        std::vector<RosterRow> rows;
+        std::size_t malformed = 0;
+    };
+
+    struct alignas(64) PoolLock
+    {
+        Mutex mutex;
+    };
+
+    struct alignas(64) HistoryPartition
+    {
+        Mutex mutex;
+        std::vector<CallRecord> records;
+        std::vector<std::size_t> calls;
+    };
+
+    bool concurrent() const
+    {
+        if constexpr (Locking::enabled)
+        {
+            return threading_ == ThreadingMode::concurrent;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    static TimePoint now()
+    {
+        if constexpr (keepsHistory)
+        {
+            return Clock::now();
+        }
+        else
+        {
+            return {};
+        }
+    }
+
+    std::shared_lock<SharedMutex> readLock() const
+    {
+        std::shared_lock<SharedMutex> lock(rosterMutex_, std::defer_lock);
+        if (concurrent())
+        {
+            lock.lock();
+        }
+        return lock;
+    }
+
+    std::unique_lock<SharedMutex> writeLock() const
+    {
+        std::unique_lock<SharedMutex> lock(rosterMutex_, std::defer_lock);
+        if (concurrent())
+        {
+            lock.lock();
+        }
+        return lock;
+    }
+
+    std::unique_lock<Mutex> lockIfConcurrent(Mutex &mutex) const
+    {
+        std::unique_lock<Mutex> lock(mutex, std::defer_lock);
+        if (concurrent())
+        {
+            lock.lock();
+        }
+        return lock;
+    }
+
+    Mutex &groupPoolMutex(StringTable::Id groupId)
+    {
+        return groupPoolLocks_[groupId % groupPoolLocks_.size()].mutex;
+    }
+
+    // Draws come from a per-thread engine in concurrent mode so that picks
+    // on different groups do not contend on one generator.
+    Engine &engine()
+    {
+        if (!concurrent())
+        {
+            return rng_;
+        }
+        thread_local Engine threadEngine{randomSeed()};
+        return threadEngine;
+    }
+
+    // Separate stream for weighted picks, derived from the session seed.
+    std::uint64_t selectorSeed() const
+    {
+        auto state = seed_;
+        return splitMix64(state);
+    }
+
+    // In concurrent mode the leaderboard update is queued on the thread's
+    // partition and applied by mergeHistoryPartitions.
+    void bumpCount(std::size_t idx)
+    {
+        auto &callCount = students_.callCount(idx);
+        if (concurrent())
+        {
+            const auto count = std::atomic_ref<int>(callCount).fetch_add(1, std::memory_order_relaxed) + 1;
+            if (selector_)
+            {
+                const std::lock_guard<Mutex> lock(weightsMutex_);
+                selector_->update(idx, count);
+            }
+            auto &partition = historyPartitions_[threadSlot() % historyPartitions_.size()];
+            const std::lock_guard<Mutex> lock(partition.mutex);
+            partition.calls.push_back(idx);
+            return;
+        }
+        ++callCount;
+        leaderboard_.increment(idx);
+        if (selector_)
+        {
+            selector_->update(idx, callCount);
+        }
+    }
+
+    // Caller holds weightsMutex_ (in concurrent mode).
+    void recordWeightedCall(std::size_t idx)
+    {
+        auto &callCount = students_.callCount(idx);
+        int count = 0;
+        if (concurrent())
+        {
+            count = std::atomic_ref<int>(callCount).fetch_add(1, std::memory_order_relaxed) + 1;
+            auto &partition = historyPartitions_[threadSlot() % historyPartitions_.size()];
+            const std::lock_guard<Mutex> lock(partition.mutex);
+            partition.calls.push_back(idx);
+        }
+        else
+        {
+            count = ++callCount;
+            leaderboard_.increment(idx);
+        }
+        selector_->update(idx, count);
+        metrics_.add(Metrics::weightedPicks);
+        const CallRecord record{students_.nameId(idx), students_.groupId(idx), now()};
+        appendHistory(&record, 1);
+        logCalls(&record, 1, walWeightedPick);
+    }
+
+    int loadCount(std::size_t idx) const
+    {
+        if (concurrent())
+        {
+            return std::atomic_ref<int>(const_cast<int &>(students_.callCounts()[idx])).load(std::memory_order_relaxed);
+        }
+        return students_.callCount(idx);
+    }
+
+    Student studentAt(std::size_t idx) const
+    {
+        return Student{students_.nameId(idx), students_.groupId(idx), loadCount(idx)};
+    }
+
+    // Concurrent picks append to the calling thread's partition; readers
+    // (which hold the exclusive lock) fold the partitions into history_ in
+    // timestamp order first, along with the queued leaderboard updates.
+    // history_, its indexes and leaderboard_ are mutable only for that fold.
+    void appendHistory(const CallRecord *records, std::size_t count)
+    {
+        if constexpr (!keepsHistory)
+        {
+            return;
+        }
+        if (!concurrent())
+        {
+            storeHistory(records, records + count);
+            return;
+        }
+        auto &partition = historyPartitions_[threadSlot() % historyPartitions_.size()];
+        const std::lock_guard<Mutex> lock(partition.mutex);
+        partition.records.insert(partition.records.end(), records, records + count);
+    }
+
+    void mergeHistoryPartitions() const
+    {
+        if (!concurrent())
+        {
+            return;
+        }
+        std::vector<CallRecord> merged;
+        for (auto &partition : historyPartitions_)
+        {
+            const std::lock_guard<Mutex> lock(partition.mutex);
+            merged.insert(merged.end(), partition.records.begin(), partition.records.end());
+            partition.records.clear();
+            for (const auto idx : partition.calls)
+            {
+                leaderboard_.increment(idx);
+            }
+            partition.calls.clear();
+        }
+        std::stable_sort(merged.begin(), merged.end(), [](const CallRecord &lhs, const CallRecord &rhs)
+                         { return lhs.timestamp < rhs.timestamp; });
+        storeHistory(merged.begin(), merged.end());
+    }
+
+    // Every append to history_ goes through here to keep the indexes current.
+    template <typename It>
+    void storeHistory(It first, It last) const
+    {
+        if constexpr (!keepsHistory)
+        {
+            return;
+        }
+        for (; first != last; ++first)
+        {
+            const auto sequence = history_.nextSequence();
+            callsByName_.add(first->nameId, sequence, history_.firstSequence());
+            callsByGroup_.add(first->groupId, sequence, history_.firstSequence());
+            history_.push_back(*first);
+        }
+    }
+
+    // Shrinking the cap evicts without an append, so the indexes are swept here.
+    void retainHistory(std::size_t limit)
+    {
+        history_.setRetention(limit);
+        callsByName_.trim(history_.firstSequence());
+        callsByGroup_.trim(history_.firstSequence());
+    }
+
+    void clearStoredHistory()
+    {
+        history_.clear();
+        callsByName_.clear();
+        callsByGroup_.clear();
+    }
+
+    std::vector<CallRecord> collectCalls(std::span<const std::uint64_t> sequences, TimePoint from, TimePoint to) const
+    {
+        const auto timeOf = [this](std::uint64_t sequence)
+        { return history_[static_cast<std::size_t>(sequence - history_.firstSequence())].timestamp; };
+        const auto begin = std::ranges::partition_point(sequences, [from](TimePoint t) { return t < from; }, timeOf);
+        const auto end = std::ranges::partition_point(
+            std::ranges::subrange(begin, sequences.end()), [to](TimePoint t) { return t < to; }, timeOf);
+        std::vector<CallRecord> records;
+        records.reserve(static_cast<std::size_t>(end - begin));
+        for (auto it = begin; it != end; ++it)
+        {
+            records.push_back(history_[static_cast<std::size_t>(*it - history_.firstSequence())]);
+        }
+        return records;
+    }
+
+    std::optional<std::size_t> findSlot(std::string_view name) const
+    {
+        const auto nameId = names_.find(name);
+        if (!nameId || slotOf(*nameId) == npos)
+        {
+            return std::nullopt;
+        }
+        return nameSlots_[*nameId];
+    }
+
+    std::optional<std::size_t> pickFromGlobal()
+    {
+        if (!liveCount())
+        {
+            return std::nullopt;
+        }
+        const Metrics::Timer timer(metrics_, Metrics::globalPickLatency);
+        const auto lock = lockIfConcurrent(globalPoolMutex_);
+        return consumeIndex(globalPool_, walGlobalPool);
+    }
+
+    std::optional<std::size_t> pickFromGroup(std::string_view group)
+    {
+        const auto groupId = groups_.find(group);
+        if (!groupId)
+        {
+            return std::nullopt;
+        }
+        const Metrics::Timer timer(metrics_, Metrics::groupPickLatency);
+        const auto lock = lockIfConcurrent(groupPoolMutex(*groupId));
+        auto &pool = groupPools_[*groupId];
+        if (pool.empty())
+        {
+            return std::nullopt;
+        }
+        return consumeIndex(pool, *groupId);
+    }
+
+    void clearPools()
+    {
+        globalPool_.restart();
+        for (auto &pool : groupPools_)
+        {
+            pool.restart();
+        }
+    }
+
+    std::size_t slotOf(StringTable::Id nameId) const
+    {
+        return nameId < nameSlots_.size() ? nameSlots_[nameId] : npos;
+    }
+
+    std::span<std::size_t> poolSlots(StringTable::Id poolId)
+    {
+        return poolId == walGlobalPool ? globalSlots_ : groupSlots_;
+    }
+
+    std::size_t liveCount() const
+    {
+        return students_.size() - removed_;
+    }
+
+    // Each row's index once removed students are dropped (npos for those).
+    std::vector<std::size_t> compactedRows() const
+    {
+        std::vector<std::size_t> rowIds(students_.size(), npos);
+        std::size_t next = 0;
+        for (std::size_t idx = 0; idx < students_.size(); ++idx)
+        {
+            if (nameSlots_[students_.nameId(idx)] == idx)
+            {
+                rowIds[idx] = next++;
+            }
+        }
+        return rowIds;
+    }
+
+    // Caller has merged the history partitions.
+    void eraseStudent(std::size_t idx)
+    {
+        globalPool_.remove(idx, globalSlots_);
+        groupPools_[students_.groupId(idx)].remove(idx, groupSlots_);
+        leaderboard_.remove(idx);
+        if (selector_)
+        {
+            selector_->removeStudent(idx);
+        }
+        nameSlots_[students_.nameId(idx)] = npos;
+        if (++removed_ > liveCount())
+        {
+            compactRoster();
+        }
+    }
+
+    // False if the student is already in `groupId`.
+    bool reassignStudent(std::size_t idx, StringTable::Id groupId)
+    {
+        const auto from = students_.groupId(idx);
+        if (from == groupId)
+        {
+            return false;
+        }
+        groupPools_[from].remove(idx, groupSlots_);
+        groupPools_[groupId].add(idx, true, groupSlots_);
+        students_.setGroupId(idx, groupId);
+        if (selector_)
+        {
+            selector_->moveStudent(idx, groupId, students_.callCount(idx));
+        }
+        return true;
+    }
+
+    // Drops the rows of removed students and renumbers the rest, keeping
+    // every cycle where it was. Caller has merged the history partitions.
+    void compactRoster()
+    {
+        const auto rowIds = compactedRows();
+        StudentColumns students(memory_);
+        students.reserve(liveCount());
+        std::vector<double> baseWeights;
+        for (std::size_t idx = 0; idx < students_.size(); ++idx)
+        {
+            if (rowIds[idx] == npos)
+            {
+                continue;
+            }
+            students.push_back(students_.nameId(idx), students_.groupId(idx), students_.callCount(idx));
+            nameSlots_[students_.nameId(idx)] = rowIds[idx];
+            if (selector_)
+            {
+                baseWeights.push_back(selector_->baseWeight(idx));
+            }
+        }
+        students_ = std::move(students);
+        removed_ = 0;
+
+        globalSlots_.assign(students_.size(), 0);
+        groupSlots_.assign(students_.size(), 0);
+        std::vector<std::size_t> order;
+        const auto renumber = [&](Pool &pool, std::span<std::size_t> slots)
+        {
+            order.clear();
+            for (const auto idx : pool.order())
+            {
+                order.push_back(rowIds[idx]);
+            }
+            pool.assign(order, pool.remaining(), slots);
+        };
+        renumber(globalPool_, globalSlots_);
+        for (auto &pool : groupPools_)
+        {
+            renumber(pool, groupSlots_);
+        }
+
+        leaderboard_.clear();
+        for (std::size_t idx = 0; idx < students_.size(); ++idx)
+        {
+            leaderboard_.insert(names_[students_.nameId(idx)], students_.callCount(idx));
+        }
+        if (selector_)
+        {
+            selector_->clear();
+            fillSelector(baseWeights);
+        }
+    }
+
+    // Rebuilds an empty selector_ over every row; removed rows get weight 0.
+    void fillSelector(const std::vector<double> &baseWeights)
+    {
+        for (std::size_t idx = 0; idx < students_.size(); ++idx)
+        {
+            selector_->addStudent(students_.groupId(idx), students_.callCount(idx), baseWeights[idx]);
+            if (nameSlots_[students_.nameId(idx)] != idx)
+            {
+                selector_->removeStudent(idx);
+            }
+        }
+    }
+
+    // The write lock keeps picks out; walMutex_ keeps out flushWal, which
+    // runs without the roster lock.
+    bool checkpointLocked()
+    {
+        const auto walLock = lockIfConcurrent(walMutex_);
+        if (!wal_.isOpen())
+        {
+            return false;
+        }
+        wal_.flush();
+        walBaseSequence_ = walSequence_;
+        return writeSnapshot(snapshotPath_) && wal_.create(walPath_, walSequence_, walOptions_);
+    }
+
+    bool writeSnapshot(const std::string &path) const
+    {
+        mergeHistoryPartitions();
+        // The snapshot no longer holds the evicted records, so they must
+        // reach the spill file first.
+        if (spill_.is_open() && !spill_.flush())
+        {
+            return false;
+        }
+        SnapshotWriter out;
+        out.put(snapshotMagic);
+        out.put(snapshotVersion);
+        out.put(snapshotByteOrder);
+        out.put(walSequence_);
+
+        out.put(static_cast<std::uint64_t>(names_.size()));
+        for (StringTable::Id id = 0; id < names_.size(); ++id)
+        {
+            out.putString(names_[id]);
+        }
+        out.put(static_cast<std::uint64_t>(groups_.size()));
+        for (StringTable::Id id = 0; id < groups_.size(); ++id)
+        {
+            out.putString(groups_[id]);
+        }
+
+        // Removed students are left out, so the snapshot is already compacted.
+        const auto rowIds = compactedRows();
+        out.put(static_cast<std::uint64_t>(liveCount()));
+        for (std::size_t idx = 0; idx < students_.size(); ++idx)
+        {
+            if (rowIds[idx] == npos)
+            {
+                continue;
+            }
+            out.put(students_.nameId(idx));
+            out.put(students_.groupId(idx));
+            out.put(static_cast<std::int32_t>(students_.callCount(idx)));
+        }
+
+        const auto putPool = [&out, &rowIds](const Pool &pool)
+        {
+            out.put(static_cast<std::uint64_t>(pool.size()));
+            out.put(static_cast<std::uint64_t>(pool.remaining()));
+            for (const auto idx : pool.order())
+            {
+                out.put(static_cast<std::uint64_t>(rowIds[idx]));
+            }
+        };
+        putPool(globalPool_);
+        for (const auto &pool : groupPools_)
+        {
+            putPool(pool);
+        }
+
+        std::ostringstream rngState;
+        rngState << rng_;
+        out.putString(engineName<Engine>());
+        out.putString(rngState.str());
+
+        // Weighted selection: off, a named strategy, or one of the caller's
+        // own, followed by the base weight of every live student.
+        if (!selector_)
+        {
+            out.put(selectorOff);
+        }
+        else
+        {
+            const auto &strategy = selector_->strategy();
+            out.put(strategy.name().empty() ? selectorCustom : selectorNamed);
+            out.putString(strategy.name());
+            out.put(strategy.parameter());
+            for (std::size_t idx = 0; idx < students_.size(); ++idx)
+            {
+                if (rowIds[idx] != npos)
+                {
+                    out.put(selector_->baseWeight(idx));
+                }
+            }
+        }
+
+        out.put(static_cast<std::uint64_t>(history_.retention()));
+        out.put(static_cast<std::uint64_t>(history_.size()));
+        for (std::size_t i = 0; i < history_.size(); ++i)
+        {
+            const auto &record = history_[i];
+            out.put(record.nameId);
+            out.put(record.groupId);
+            out.put(static_cast<std::int64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(record.timestamp.time_since_epoch()).count()));
+        }
+
+        return writeFileAtomically(path, out.data());
+    }
+
+    bool readSnapshot(std::string_view data)
+    {
+        SnapshotReader in(data);
+
+        std::uint64_t magic = 0;
+        std::uint32_t version = 0;
+        std::uint32_t byteOrder = 0;
+        std::uint64_t walSequence = 0;
+        if (!in.get(magic) || !in.get(version) || !in.get(byteOrder) || magic != snapshotMagic ||
+            version != snapshotVersion || byteOrder != snapshotByteOrder || !in.get(walSequence))
+        {
+            return false;
+        }
+
+        const auto getStrings = [&in](StringTable &table)
+        {
+            std::uint64_t count = 0;
+            if (!in.get(count) || !in.canHold(count, sizeof(std::uint32_t)))
+            {
+                return false;
+            }
+            for (std::uint64_t i = 0; i < count; ++i)
+            {
+                std::string_view text;
+                if (!in.getString(text) || table.intern(text) != i)
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+        StringTable names(memory_);
+        StringTable groups(memory_);
+        if (!getStrings(names) || !getStrings(groups))
+        {
+            return false;
+        }
+
+        std::uint64_t studentCount = 0;
+        if (!in.get(studentCount) || !in.canHold(studentCount, 3 * sizeof(std::uint32_t)))
+        {
+            return false;
+        }
+        StudentColumns students(memory_);
+        students.reserve(studentCount);
+        std::pmr::vector<std::size_t> nameSlots(names.size(), npos, memory_);
+        std::vector<std::size_t> groupSizes(groups.size());
+        for (std::size_t i = 0; i < studentCount; ++i)
+        {
+            StringTable::Id nameId = 0;
+            StringTable::Id groupId = 0;
+            std::int32_t callCount = 0;
+            if (!in.get(nameId) || !in.get(groupId) || !in.get(callCount) || nameId >= names.size() ||
+                groupId >= groups.size() || nameSlots[nameId] != npos)
+            {
+                return false;
+            }
+            students.push_back(nameId, groupId, callCount);
+            nameSlots[nameId] = i;
+            ++groupSizes[groupId];
+        }
+
+        // A pool must list exactly its members; `groupId` npos means the
+        // whole roster.
+        std::pmr::vector<std::size_t> globalSlots(students.size(), 0, memory_);
+        std::pmr::vector<std::size_t> groupSlots(students.size(), 0, memory_);
+        const auto getPool = [&in, &students, &globalSlots, &groupSlots](Pool &pool, std::size_t members,
+                                                                         std::size_t groupId)
+        {
+            std::uint64_t count = 0;
+            std::uint64_t remaining = 0;
+            if (!in.get(count) || !in.get(remaining) || count != members || remaining > count ||
+                !in.canHold(count, sizeof(std::uint64_t)))
+            {
+                return false;
+            }
+            std::vector<std::size_t> order(count);
+            std::vector<bool> seen(students.size());
+            for (auto &idx : order)
+            {
+                std::uint64_t value = 0;
+                if (!in.get(value) || value >= students.size() || seen[value] ||
+                    (groupId != npos && students.groupId(value) != groupId))
+                {
+                    return false;
+                }
+                seen[value] = true;
+                idx = static_cast<std::size_t>(value);
+            }
+            pool.assign(order, remaining, groupId == npos ? globalSlots : groupSlots);
+            return true;
+        };
+        Pool globalPool(memory_);
+        std::pmr::vector<Pool> groupPools(memory_);
+        groupPools.reserve(groups.size());
+        for (std::size_t groupId = 0; groupId < groups.size(); ++groupId)
+        {
+            groupPools.emplace_back(memory_);
+        }
+        if (!getPool(globalPool, students.size(), npos))
+        {
+            return false;
+        }
+        for (std::size_t groupId = 0; groupId < groupPools.size(); ++groupId)
+        {
+            if (!getPool(groupPools[groupId], groupSizes[groupId], groupId))
+            {
+                return false;
+            }
+        }
+
+        std::string_view rngName;
+        std::string_view rngText;
+        if (!in.getString(rngName) || rngName != engineName<Engine>() || !in.getString(rngText))
+        {
+            return false;
+        }
+        std::istringstream rngState{std::string(rngText)};
+        auto rng = rng_;
+        if (!(rngState >> rng))
+        {
+            return false;
+        }
+
+        // A strategy without a name comes back as the one this manager has
+        // installed, if any.
+        std::uint32_t selectorState = 0;
+        std::unique_ptr<SelectionStrategy> strategy;
+        std::vector<double> baseWeights;
+        if (!in.get(selectorState) || selectorState > selectorCustom)
+        {
+            return false;
+        }
+        if (selectorState != selectorOff)
+        {
+            std::string_view strategyName;
+            double parameter = 0;
+            if (!in.getString(strategyName) || !in.get(parameter) ||
+                !in.canHold(students.size(), sizeof(double)))
+            {
+                return false;
+            }
+            if (selectorState == selectorNamed && !(strategy = makeSelectionStrategy(strategyName, parameter)))
+            {
+                return false;
+            }
+            baseWeights.resize(students.size());
+            for (auto &weight : baseWeights)
+            {
+                if (!in.get(weight) || !(weight >= 0))
+                {
+                    return false;
+                }
+            }
+        }
+
+        std::uint64_t retention = 0;
+        std::uint64_t recordCount = 0;
+        if (!in.get(retention) || !in.get(recordCount) ||
+            !in.canHold(recordCount, 2 * sizeof(std::uint32_t) + sizeof(std::int64_t)))
+        {
+            return false;
+        }
+        std::vector<CallRecord> records(recordCount);
+        for (auto &record : records)
+        {
+            std::int64_t nanoseconds = 0;
+            if (!in.get(record.nameId) || !in.get(record.groupId) || !in.get(nanoseconds) ||
+                record.nameId >= names.size() || record.groupId >= groups.size())
+            {
+                return false;
+            }
+            record.timestamp = std::chrono::system_clock::time_point(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(nanoseconds)));
+        }
+        if (!in.atEnd())
+        {
+            return false;
+        }
+
+        mergeHistoryPartitions();
+        students_ = std::move(students);
+        names_ = std::move(names);
+        groups_ = std::move(groups);
+        nameSlots_ = std::move(nameSlots);
+        globalPool_ = std::move(globalPool);
+        groupPools_ = std::move(groupPools);
+        globalSlots_ = std::move(globalSlots);
+        groupSlots_ = std::move(groupSlots);
+        removed_ = 0;
+        syncSources_.clear();
+        rng_ = rng;
+        walSequence_ = walSequence;
+        leaderboard_.clear();
+        for (std::size_t idx = 0; idx < students_.size(); ++idx)
+        {
+            leaderboard_.insert(names_[students_.nameId(idx)], students_.callCount(idx));
+        }
+        if (selectorState == selectorCustom && selector_)
+        {
+            strategy = selector_->releaseStrategy();
+        }
+        selector_.reset();
+        if (strategy)
+        {
+            selector_ = std::make_unique<WeightedSelector>(std::move(strategy), selectorSeed());
+            fillSelector(baseWeights);
+        }
+        clearStoredHistory();
+        history_.setRetention(0);
+        storeHistory(records.begin(), records.end());
+        retainHistory(static_cast<std::size_t>(retention));
+        return true;
+    }
+
+    bool insertStudent(std::string_view name, std::string_view group, bool refreshPools)
+    {
+        if (findSlot(name))
+        {
+            return false;
+        }
+
+        const auto nameId = internName(name);
+        const auto groupId = internGroup(group);
+        if (nameId >= nameSlots_.size())
+        {
+            nameSlots_.resize(nameId + 1, npos);
+        }
+        nameSlots_[nameId] = students_.size();
+        students_.push_back(nameId, groupId, 0);
+        globalSlots_.push_back(0);
+        groupSlots_.push_back(0);
+        leaderboard_.insert(names_[nameId], 0);
+        if (selector_)
+        {
+            selector_->addStudent(groupId, 0);
+        }
+        globalPool_.add(students_.size() - 1, refreshPools, globalSlots_);
+        groupPools_[groupId].add(students_.size() - 1, refreshPools, groupSlots_);
+        return true;
+    }
+
+    void checkpointIfLogging()
+    {
+        if (wal_.isOpen())
+        {
+            checkpointLocked();
+        }
+    }
+
+    // Roster changes are logged, so they only checkpoint once the log has
+    // grown past walOptions_.checkpointRecords.
+    void checkpointIfDue()
+    {
+        if (wal_.isOpen() && walSequence_ - walBaseSequence_ >= walOptions_.checkpointRecords)
+        {
+            checkpointLocked();
+        }
+    }
+
+    // Appends `text` in walText records ahead of the record itself.
+    void logRoster(StringTable::Id kind, StringTable::Id id, std::int64_t value, std::string_view text = {})
+    {
+        const auto lock = lockIfConcurrent(walMutex_);
+        if (!wal_.isOpen() || importing_)
+        {
+            return;
+        }
+        for (std::size_t offset = 0; offset < text.size(); offset += walTextBytes)
+        {
+            WalRecord chunk{static_cast<StringTable::Id>(std::min(walTextBytes, text.size() - offset)), walText, 0};
+            std::memcpy(&chunk.timestamp, text.data() + offset, chunk.nameId);
+            wal_.append(chunk);
+            ++walSequence_;
+        }
+        wal_.append(WalRecord{id, kind, value});
+        ++walSequence_;
+    }
+
+    // The student just appended by insertStudent.
+    void logAdd(bool refreshPools)
+    {
+        const auto idx = students_.size() - 1;
+        logRoster(walAdd, students_.nameId(idx),
+                  static_cast<std::int64_t>(students_.groupId(idx)) | (refreshPools ? std::int64_t{1} << 32 : 0));
+    }
+
+    // Interning is logged too, so replay hands out the same name and group
+    // ids the picks in the log refer to.
+    StringTable::Id internName(std::string_view name)
+    {
+        const auto before = names_.size();
+        const auto nameId = names_.intern(name);
+        if (names_.size() != before)
+        {
+            logRoster(walName, nameId, 0, name);
+        }
+        return nameId;
+    }
+
+    // Re-applies a logged roster record; `text` holds the walText payload
+    // gathered since the previous one.
+    void replayRosterChange(const WalRecord &record, std::string_view text)
+    {
+        if (record.poolId == walName)
+        {
+            names_.intern(text);
+            return;
+        }
+        if (record.poolId == walGroup)
+        {
+            internGroup(text);
+            return;
+        }
+        if (record.poolId == walWeight)
+        {
+            const auto idx = record.nameId < nameSlots_.size() ? nameSlots_[record.nameId] : npos;
+            const auto weight = std::bit_cast<double>(record.timestamp);
+            if (selector_ && idx != npos && weight >= 0)
+            {
+                selector_->setBaseWeight(idx, weight, students_.callCount(idx));
+            }
+            return;
+        }
+        const auto groupId = static_cast<StringTable::Id>(record.timestamp & 0xffffffff);
+        if (record.nameId >= names_.size() || (record.poolId != walRemove && groupId >= groups_.size()))
+        {
+            return;
+        }
+        if (record.poolId == walAdd)
+        {
+            insertStudent(names_[record.nameId], groups_[groupId], (record.timestamp >> 32) != 0);
+            return;
+        }
+        if (record.nameId >= nameSlots_.size() || nameSlots_[record.nameId] == npos)
+        {
+            return;
+        }
+        if (record.poolId == walRemove)
+        {
+            eraseStudent(nameSlots_[record.nameId]);
+        }
+        else
+        {
+            reassignStudent(nameSlots_[record.nameId], groupId);
+        }
+    }
+
+    void logCalls(const CallRecord *records, std::size_t count, StringTable::Id poolId)
+    {
+        const auto lock = lockIfConcurrent(walMutex_);
+        if (!wal_.isOpen())
+        {
+            return;
+        }
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            wal_.append(WalRecord{
+                records[i].nameId, poolId,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(records[i].timestamp.time_since_epoch()).count()});
+        }
+        walSequence_ += count;
+    }
+
+    // Re-runs a logged pick. Draws happen in the same order and with the same
+    // RNG state as in the original session, so the cycle positions come back
+    // exactly; a diverged pool falls back to marking the student as called.
+    bool replayCall(const WalRecord &record)
+    {
+        if (record.nameId >= nameSlots_.size() || nameSlots_[record.nameId] == npos ||
+            (record.poolId < walWeightedPick && record.poolId >= groupPools_.size()))
+        {
+            return false;
+        }
+        const auto idx = nameSlots_[record.nameId];
+        if (record.poolId == walWeightedPick)
+        {
+            bumpCount(idx);
+            const CallRecord call{
+                students_.nameId(idx), students_.groupId(idx),
+                std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                    std::chrono::nanoseconds(record.timestamp)))};
+            storeHistory(&call, &call + 1);
+            return true;
+        }
+        auto &pool = record.poolId == walGlobalPool ? globalPool_ : groupPools_[record.poolId];
+        if (pool.empty())
+        {
+            return false;
+        }
+        if (pool.exhausted())
+        {
+            pool.restart();
+        }
+        const auto slots = poolSlots(record.poolId);
+        if (pool.draw(engine(), slots) != idx)
+        {
+            pool.undraw();
+            pool.markCalled(idx, slots);
+        }
+
+        bumpCount(idx);
+        const CallRecord call{
+            students_.nameId(idx), students_.groupId(idx),
+            std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::nanoseconds(record.timestamp)))};
+        storeHistory(&call, &call + 1);
+        return true;
+    }
+
+    // Same line splitting as std::getline, without copying any line out of
+    // the buffer.
+    template <typename Fn>
+    static void forEachLine(std::string_view data, Fn &&fn)
+    {
+        const char *cursor = data.data();
+        const char *const end = cursor + data.size();
+        while (cursor != end)
+        {
+            const char *newline = findByte(cursor, end, '\n');
+            fn(std::string_view(cursor, static_cast<std::size_t>(newline - cursor)));
+            cursor = newline == end ? end : newline + 1;
+        }
+    }
+
+    void loadFromBuffer(std::string_view data, ImportStats &stats)
+    {
+        forEachLine(data, [this, &stats](std::string_view line) { loadLine(line, stats); });
+    }
+
+    void loadLine(std::string_view line, ImportStats &stats)
+    {
+        RosterRow row;
+        const auto kind = parseLine(line, row);
+        if (kind == LineKind::malformed)
+        {
+            ++stats.malformed;
+        }
+        else if (kind == LineKind::row)
+        {
+            ++(insertStudent(row.name, row.group, false) ? stats.added : stats.duplicates);
+        }
+    }
+
+    // Records the row in `rows` and applies it if it is new to the file, or
+    // if its group differs from the one in `previous` (for a full diff). A
+    // new row naming a student already on the roster moves them to its group.
+    void syncLine(std::string_view line, std::unordered_map<StringTable::Id, StringTable::Id> &rows,
+                  const std::unordered_map<StringTable::Id, StringTable::Id> *previous, SyncStats &stats)
+    {
+        RosterRow row;
+        const auto kind = parseLine(line, row);
+        if (kind == LineKind::malformed)
+        {
+            ++stats.malformed;
+            return;
+        }
+        if (kind != LineKind::row)
+        {
+            return;
+        }
+        const auto nameId = internName(row.name);
+        const auto groupId = internGroup(row.group);
+        if (!rows.emplace(nameId, groupId).second)
+        {
+            ++stats.duplicates;
+            return;
+        }
+        if (previous)
+        {
+            if (const auto old = previous->find(nameId); old != previous->end())
+            {
+                const auto idx = slotOf(nameId);
+                if (old->second != groupId && idx != npos && reassignStudent(idx, groupId))
+                {
+                    logRoster(walMove, nameId, groupId);
+                    ++stats.moved;
+                }
+                return;
+            }
+        }
+        if (const auto idx = slotOf(nameId); idx != npos)
+        {
+            if (reassignStudent(idx, groupId))
+            {
+                logRoster(walMove, nameId, groupId);
+                ++stats.moved;
+            }
+            else
+            {
+                ++stats.duplicates;
+            }
+            return;
+        }
+        if (insertStudent(row.name, row.group, true))
+        {
+            logAdd(true);
+            ++stats.added;
+        }
+        else
+        {
+            ++stats.duplicates;
+        }
+    }
+
+    static LineKind parseLine(std::string_view line, RosterRow &row)
+    {
+        const auto trimmed = trim(line);
+        if (trimmed.empty() || trimmed.front() == '#')
+        {
+            return LineKind::blank;
+        }
+
+        const auto comma = findByte(trimmed.data(), trimmed.data() + trimmed.size(), ',');
+        if (comma == trimmed.data() + trimmed.size())
+        {
+            return LineKind::malformed;
+        }
+
+        const auto split = static_cast<std::size_t>(comma - trimmed.data());
+        row.name = trim(trimmed.substr(0, split));
+        row.group = trim(trimmed.substr(split + 1));
+        return row.name.empty() || row.group.empty() ? LineKind::malformed : LineKind::row;
+    }
+
+    // Runs on an import worker without the lock; the rows view the mapping.
+    static void stageFile(const std::string &path, StagedFile &staged)
+    {
+        staged.file.emplace(path);
+        if (!staged.file->isOpen())
+        {
+            return;
+        }
+        parseLines(staged.file->view(), staged.rows, staged.malformed);
+    }
+
+    // Calls fn(worker, first, last) for `workers` contiguous slices of
+    // [0, rows): slice 0 on the calling thread, the rest on their own.
+    template <typename Fn>
+    static void forEachSlice(std::size_t rows, std::size_t workers, Fn &&fn)
+    {
+        const auto bound = [rows, workers](std::size_t worker) { return rows * worker / workers; };
+        std::vector<std::jthread> threads;
+        for (std::size_t worker = 1; worker < workers; ++worker)
+        {
+            threads.emplace_back([&fn, bound, worker] { fn(worker, bound(worker), bound(worker + 1)); });
+        }
+        fn(0, 0, bound(1));
+    }
+
+    template <typename Rows>
+    static void parseLines(std::string_view data, Rows &rows, std::size_t &malformed)
+    {
+        forEachLine(data,
+                    [&rows, &malformed](std::string_view line)
+                    {
+                        RosterRow row;
+                        const auto kind = parseLine(line, row);
+                        if (kind == LineKind::malformed)
+                        {
+                            ++malformed;
+                        }
+                        else if (kind == LineKind::row)
+                        {
+                            rows.push_back(row);
+                        }
+                    });
+    }
+
+    // Reader stage of importFromFileAsync. A block ends at its last newline
+    // and the partial line after it starts the next one, so the rows come
+    // out exactly as forEachLine would split the whole file. Returns the
+    // bytes read.
+    static std::size_t readChunks(std::istream &in, std::size_t chunkSize, BoundedQueue<ParsedChunk> &out,
+                                  std::stop_token stop)
+    {
+        std::size_t bytes = 0;
+        std::vector<char> carry;
+        bool last = false;
+        while (!last && !stop.stop_requested())
+        {
+            ParsedChunk chunk;
+            chunk.text.swap(carry);
+            const auto kept = chunk.text.size();
+            chunk.text.resize(kept + chunkSize);
+            in.read(chunk.text.data() + kept, static_cast<std::streamsize>(chunkSize));
+            const auto got = static_cast<std::size_t>(in.gcount());
+            bytes += got;
+            chunk.text.resize(kept + got);
+            last = !in;
+            if (!last)
+            {
+                const auto newline = std::string_view(chunk.text.data(), chunk.text.size()).rfind('\n');
+                const auto end = newline == std::string_view::npos ? 0 : newline + 1;
+                carry.assign(chunk.text.begin() + static_cast<std::ptrdiff_t>(end), chunk.text.end());
+                chunk.text.resize(end);
+            }
+            if (chunk.text.empty())
+            {
+                continue;
+            }
+            parseLines(std::string_view(chunk.text.data(), chunk.text.size()), chunk.rows, chunk.malformed);
+            if (!out.push(std::move(chunk), stop))
+            {
+                break;
+            }
+        }
+        out.close();
+        return bytes;
+    }
+
+    static std::string_view trim(std::string_view text)
+    {
+        const auto first = text.find_first_not_of(" \t\r\n");
+        if (first == std::string_view::npos)
+        {
+            return {};
+        }
+        const auto last = text.find_last_not_of(" \t\r\n");
+        return text.substr(first, last - first + 1);
+    }
+
+    std::size_t consumeIndex(Pool &pool, StringTable::Id poolId)
+    {
+        const bool global = poolId == walGlobalPool;
+        if (pool.exhausted())
+        {
+            pool.restart();
+            metrics_.add(global ? Metrics::globalRestarts : Metrics::groupRestarts);
+        }
+        const auto idx = pool.draw(engine(), poolSlots(poolId));
+        metrics_.add(global ? Metrics::globalPicks : Metrics::groupPicks);
+        bumpCount(idx);
+        const CallRecord record{students_.nameId(idx), students_.groupId(idx), now()};
+        appendHistory(&record, 1);
+        logCalls(&record, 1, poolId);
+        return idx;
+    }
+
+    void spillRecords(const CallRecord *records, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            spill_ << spillTimestamps_.format(records[i].timestamp) << ',' << groups_[records[i].groupId] << ','
+                   << names_[records[i].nameId] << '\n';
+        }
+    }
+
+    StringTable::Id internGroup(std::string_view group)
+    {
+        const auto groupId = groups_.intern(group);
+        if (groupId >= groupPools_.size())
+        {
+            groupPools_.emplace_back(memory_);
+            logRoster(walGroup, groupId, 0, group);
+        }
+        return groupId;
+    }
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+    static constexpr std::uint64_t snapshotMagic = 0x50414e5352544352; // "RCTRSNAP"
+    static constexpr std::uint32_t snapshotVersion = 5;
+    static constexpr std::uint32_t selectorOff = 0;
+    static constexpr std::uint32_t selectorNamed = 1;
+    static constexpr std::uint32_t selectorCustom = 2;
+    static constexpr std::uint64_t exportMagic = 0x5450584552544352; // "RCTREXPT"
+    static constexpr std::uint32_t exportVersion = 1;
+    static constexpr StringTable::Id walGlobalPool = std::numeric_limits<StringTable::Id>::max();
+    static constexpr StringTable::Id walWeightedPick = walGlobalPool - 1;
+    // Roster changes share the log with picks. walText records carry up to
+    // walTextBytes of a name or group in their timestamp field.
+    static constexpr StringTable::Id walText = walGlobalPool - 2;
+    static constexpr StringTable::Id walAdd = walGlobalPool - 3;
+    static constexpr StringTable::Id walRemove = walGlobalPool - 4;
+    static constexpr StringTable::Id walMove = walGlobalPool - 5;
+    static constexpr StringTable::Id walName = walGlobalPool - 6;
+    static constexpr StringTable::Id walGroup = walGlobalPool - 7;
+    static constexpr StringTable::Id walWeight = walGlobalPool - 8;
+    static constexpr std::size_t walTextBytes = sizeof(std::int64_t);
+    static constexpr std::uint32_t snapshotByteOrder = 0x01020304;
+    static constexpr std::streamoff binaryCountOffset =
+        sizeof(exportMagic) + sizeof(exportVersion) + sizeof(snapshotByteOrder);
+    // Blocks an async import or export stage may run ahead of the other.
+    static constexpr std::size_t pipelineDepth = 4;
+    // Below this many rows per thread, callReport stays on fewer threads.
+    static constexpr std::size_t minRowsPerWorker = 1 << 16;
+
+    std::pmr::memory_resource *const memory_;
+    StudentColumns students_;
+    StringTable names_;
+    StringTable groups_;
+    std::pmr::vector<std::size_t> nameSlots_;
+    std::pmr::vector<Pool> groupPools_;
+    Pool globalPool_;
+    // Each student's position in globalPool_ and in its group's pool.
+    std::pmr::vector<std::size_t> globalSlots_;
+    std::pmr::vector<std::size_t> groupSlots_;
+    // Rows of removed students, left in place until compactRoster.
+    std::size_t removed_ = 0;
+    mutable History history_;
+    mutable SequenceIndex callsByName_;
+    mutable SequenceIndex callsByGroup_;
+    mutable std::array<HistoryPartition, Locking::enabled ? 16 : 1> historyPartitions_;
+    mutable std::ofstream spill_;
+    TimestampFormatter spillTimestamps_;
+    WriteAheadLog<WalRecord> wal_;
+    std::string walPath_;
+    std::string snapshotPath_;
+    WalOptions walOptions_;
+    std::uint64_t walSequence_ = 0;
+    // walSequence_ when the current log was started.
+    std::uint64_t walBaseSequence_ = 0;
+    // Imports checkpoint when done, so the rows they insert are not logged.
+    bool importing_ = false;
+    std::unordered_map<std::string, SyncSource> syncSources_;
+    const ThreadingMode threading_;
+    std::uint64_t seed_;
+    Engine rng_;
+    mutable SharedMutex rosterMutex_;
+    Mutex globalPoolMutex_;
+    std::array<PoolLock, Locking::enabled ? 64 : 1> groupPoolLocks_;
+    Mutex walMutex_;
+    std::unique_ptr<WeightedSelector> selector_;
+    Mutex weightsMutex_;
+    Metrics metrics_;
+    mutable CallLeaderboard leaderboard_;
+};
+
+using RosterManager = BasicRosterManager<>;
+
+// Coarse clock reads and 12-byte history records, for long runs with
+// heavy pick traffic; history times are kept to the millisecond.
+using CompactRosterManager =
+    BasicRosterManager<RosterPolicies<Xoshiro256StarStar, CoarseClock, SharedLocking, CompactHistory>>;
+
+// For a kiosk that only ever picks: one thread, no call log.
+using KioskRosterManager =
+    BasicRosterManager<RosterPolicies<Xoshiro256StarStar, std::chrono::system_clock, NoLocking, NullHistory>>;
+
+#if defined(__linux__)
+// Hosts one RosterManager per course behind a single epoll loop. Requests
+// are tab-separated lines and every request gets exactly one response line,
+// in order, so clients may pipeline as many requests as they like:
+//
+//   ADD <course> <name> <group>      -> OK added | OK duplicate
+//   PICK <course> [group]            -> OK <name> <group>
+//   BATCH <course> <k> [group]       -> OK <n> (<name> <group>)*    (k <= 65536)
+//   HISTORY <course> <limit>         -> OK <n> (<time> <group> <name>)*
+//   STATS <course> [top]             -> OK <students> <groups> <calls> (<name> <group> <count>)*
+//   IMPORT <course> <file>           -> OK <added> <duplicates> <malformed>
+//   EXPORT <course> <file> [limit]   -> OK exported
+//
+// Failures answer "ERR <reason>". IMPORT and EXPORT work on files under the
+// directory given to setFileRoot (they are refused without one) and run in
+// slices between other clients' requests; the connection's later requests
+// wait for the reply, so the order still holds.
+class RosterServer
 {
 public:
-    struct Student
+    RosterServer() = default;
+    RosterServer(const RosterServer &) = delete;
+    RosterServer &operator=(const RosterServer &) = delete;
+
+    ~RosterServer()
+    {
+        for (const auto &entry : connections_)
+        {
+            ::close(entry.first);
+        }
+        if (listenFd_ >= 0)
+        {
+            ::close(listenFd_);
+        }
+        if (epollFd_ >= 0)
+        {
+            ::close(epollFd_);
+        }
+        if (inotifyFd_ >= 0)
+        {
+            ::close(inotifyFd_);
+        }
+    }
+
+    RosterManager &course(const std::string &name)
+    {
+        auto &manager = courses_[name];
+        if (!manager)
+        {
+            manager = std::make_unique<RosterManager>();
+            manager->enableMetrics(!metricsPath_.empty());
+        }
+        return *manager;
+    }
+
+    // Rewrites `path` every `interval` with the metrics of every course,
+    // labelled course="<name>": Prometheus text, or the binary dump when the
+    // path ends in ".bin".
+    void setMetricsDump(std::string path, std::chrono::seconds interval)
+    {
+        metricsPath_ = std::move(path);
+        metricsInterval_ = interval;
+        for (auto &entry : courses_)
+        {
+            entry.second->enableMetrics();
+        }
+    }
+
+    // Lets IMPORT and EXPORT use files under `directory`.
+    void setFileRoot(std::string directory)
+    {
+        if (!directory.empty() && directory.back() != '/')
+        {
+            directory.push_back('/');
+        }
+        fileRoot_ = std::move(directory);
+    }
+
+    // Syncs the course from `path` now and again whenever the file is
+    // rewritten or replaced. The directory is watched, not the file, so a
+    // rename over the roster is seen too.
+    std::optional<RosterManager::SyncStats> syncCourse(const std::string &name, const std::string &path)
+    {
+        const auto stats = course(name).syncFromFile(path);
+        if (!stats)
+        {
+            return std::nullopt;
+        }
+        if (inotifyFd_ < 0)
+        {
+            inotifyFd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        }
+        const auto slash = path.rfind('/');
+        const auto directory = slash == std::string::npos ? std::string(".") : path.substr(0, slash + 1);
+        const int wd =
+            inotifyFd_ < 0 ? -1 : ::inotify_add_watch(inotifyFd_, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd >= 0)
+        {
+            const auto file = slash == std::string::npos ? path : path.substr(slash + 1);
+            syncWatches_.push_back(SyncWatch{wd, file, name, path});
+        }
+        return stats;
+    }
+
+    bool listen(std::uint16_t port)
     {
-        std::string name;
-        std::string group;
-        int callCount = 0;
+        listenFd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd_ < 0)
+        {
+            return false;
+        }
+        const int on = 1;
+        ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if (::bind(listenFd_, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+            ::listen(listenFd_, SOMAXCONN) != 0)
+        {
+            return false;
+        }
+        epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        return epollFd_ >= 0 && watch(listenFd_, EPOLLIN, EPOLL_CTL_ADD) &&
+               watch(jobsReady_.fd(), EPOLLIN, EPOLL_CTL_ADD) &&
+               (inotifyFd_ < 0 || watch(inotifyFd_, EPOLLIN, EPOLL_CTL_ADD));
+    }
+
+    // Serves until `stop` becomes non-zero (checked whenever epoll_wait
+    // returns, which includes being interrupted by a signal).
+    void run(const volatile std::sig_atomic_t &stop)
+    {
+        std::array<epoll_event, 256> events{};
+        while (!stop)
+        {
+            const int ready = ::epoll_wait(epollFd_, events.data(), static_cast<int>(events.size()), 1000);
+            if (ready < 0 && errno != EINTR)
+            {
+                return;
+            }
+            for (int i = 0; i < ready; ++i)
+            {
+                const int fd = events[i].data.fd;
+                if (fd == listenFd_)
+                {
+                    acceptAll();
+                    continue;
+                }
+                if (fd == inotifyFd_)
+                {
+                    syncChanged();
+                    continue;
+                }
+                if (fd == jobsReady_.fd())
+                {
+                    continue;
+                }
+                if (events[i].events & EPOLLERR)
+                {
+                    closeConnection(fd);
+                    continue;
+                }
+                // A hang-up still leaves the requests sent before it to answer.
+                if ((events[i].events & (EPOLLIN | EPOLLHUP)) && !readFrom(fd))
+                {
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT)
+                {
+                    // Draining a backlog lets the requests queued behind it run.
+                    const bool paused = connections_[fd].paused;
+                    if (writeTo(fd) && paused && !connections_[fd].paused)
+                    {
+                        processInput(fd);
+                    }
+                }
+            }
+            stepJobs();
+            if (!metricsPath_.empty() && std::chrono::steady_clock::now() >= nextMetricsDump_)
+            {
+                dumpMetrics();
+                nextMetricsDump_ = std::chrono::steady_clock::now() + metricsInterval_;
+            }
+        }
+    }
+
+private:
+    struct SyncWatch
+    {
+        int wd;
+        std::string file;
+        std::string course;
+        std::string path;
+        bool pending = false;
     };
 
-    struct CallRecord
+    struct Connection
     {
-        std::string name;
-        std::string group;
-        std::chrono::system_clock::time_point timestamp;
+        std::uint64_t id = 0;
+        std::string input;
+        std::string output;
+        std::size_t written = 0;
+        bool wantsWrite = false;
+        // Waiting on a job; input is left unread until it replies.
+        bool busy = false;
+        // The peer has shut down its side; close once every reply is out.
+        bool closing = false;
+        // More than outputHighWater is waiting to be sent; requests are left
+        // unread until it drains below outputLowWater.
+        bool paused = false;
+        // What epoll is currently watching for.
+        std::uint32_t events = EPOLLIN;
     };
 
-    struct ImportStats
+    // The connection is matched by id too, as its fd may be reused once
+    // it closes.
+    struct Job
     {
-        std::size_t added = 0;
-        std::size_t duplicates = 0;
-        std::size_t malformed = 0;
+        int fd;
+        std::uint64_t connection;
+        Task<std::string> reply;
     };
 
-    RosterManager() : rng_(std::random_device{}()) {}
+    static constexpr std::size_t maxLine = 1 << 20;
+    static constexpr std::size_t outputHighWater = 4 << 20;
+    static constexpr std::size_t outputLowWater = 1 << 20;
+    // Largest k a BATCH request may ask for.
+    static constexpr std::size_t maxBatch = 1 << 16;
+
+    bool watch(int fd, std::uint32_t events, int operation)
+    {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        return ::epoll_ctl(epollFd_, operation, fd, &event) == 0;
+    }
+
+    void updateEvents(int fd, Connection &connection)
+    {
+        const bool reading = !connection.busy && !connection.closing && !connection.paused;
+        const auto events = (reading ? EPOLLIN : 0u) | (connection.wantsWrite ? EPOLLOUT : 0u);
+        if (events != connection.events)
+        {
+            connection.events = events;
+            watch(fd, events, EPOLL_CTL_MOD);
+        }
+    }
+
+    static std::size_t unsent(const Connection &connection)
+    {
+        return connection.output.size() - connection.written;
+    }
+
+    void acceptAll()
+    {
+        while (true)
+        {
+            const int fd = ::accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                return;
+            }
+            const int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            if (!watch(fd, EPOLLIN, EPOLL_CTL_ADD))
+            {
+                ::close(fd);
+                continue;
+            }
+            connections_[fd].id = ++connectionCount_;
+        }
+    }
+
+    // Reads whatever has arrived and answers it. At end of stream the lines
+    // already buffered are still answered before the connection closes.
+    // Returns false if the connection was closed.
+    bool readFrom(int fd)
+    {
+        auto &connection = connections_[fd];
+        std::array<char, 64 * 1024> buffer;
+        while (!connection.closing && !connection.paused && connection.input.size() <= maxLine)
+        {
+            const auto n = ::recv(fd, buffer.data(), buffer.size(), 0);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                closeConnection(fd);
+                return false;
+            }
+            if (n == 0)
+            {
+                connection.closing = true;
+                updateEvents(fd, connection);
+                break;
+            }
+            if (n < 0)
+            {
+                break;
+            }
+            connection.input.append(buffer.data(), static_cast<std::size_t>(n));
+        }
+        return processInput(fd);
+    }
+
+    // Handles every complete line buffered so far and answers them with a
+    // single write, stopping after one that starts a job or once the replies
+    // pass outputHighWater. Returns false if the connection was closed.
+    bool processInput(int fd)
+    {
+        auto &connection = connections_[fd];
+        while (true)
+        {
+            std::size_t consumed = 0;
+            while (!connection.busy && !connection.paused)
+            {
+                const auto newline = connection.input.find('\n', consumed);
+                if (newline == std::string::npos)
+                {
+                    break;
+                }
+                auto line = std::string_view(connection.input).substr(consumed, newline - consumed);
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.remove_suffix(1);
+                }
+                handle(line, fd, connection);
+                consumed = newline + 1;
+                connection.paused = unsent(connection) > outputHighWater;
+            }
+            connection.input.erase(0, consumed);
+            if (!connection.busy && !connection.paused && connection.input.size() > maxLine && !connection.closing)
+            {
+                closeConnection(fd);
+                return false;
+            }
+            const bool paused = connection.paused;
+            if (!writeTo(fd))
+            {
+                return false;
+            }
+            // A peer that reads quickly may have taken the backlog already.
+            if (!paused || connection.paused)
+            {
+                return true;
+            }
+        }
+    }
+
+    void startJob(int fd, Connection &connection, Task<std::string> reply)
+    {
+        connection.busy = true;
+        jobs_.push_back(Job{fd, connection.id, std::move(reply)});
+    }
+
+    // Runs one slice of every job; a finished job's reply goes out and its
+    // connection carries on with the requests that queued up behind it.
+    // Called after every epoll_wait, so a job that is waiting on its thread
+    // is only stepped again once jobsReady_ fires.
+    void stepJobs()
+    {
+        if (jobs_.empty())
+        {
+            return;
+        }
+        jobsReady_.clear();
+        for (std::size_t i = 0; i < jobs_.size();)
+        {
+            if (jobs_[i].reply.step())
+            {
+                ++i;
+                continue;
+            }
+            auto job = std::move(jobs_[i]);
+            jobs_.erase(jobs_.begin() + static_cast<std::ptrdiff_t>(i));
+            const auto it = connections_.find(job.fd);
+            if (it == connections_.end() || it->second.id != job.connection)
+            {
+                continue;
+            }
+            it->second.output.append(job.reply.result());
+            it->second.busy = false;
+            updateEvents(job.fd, it->second);
+            processInput(job.fd);
+        }
+    }
+
+    static Task<std::string> importJob(RosterManager &manager, std::string path, Wakeup &ready)
+    {
+        auto import = manager.importFromFileAsync(std::move(path), 64 * 1024, &ready);
+        while (import.step())
+        {
+            co_await std::suspend_always{};
+        }
+        const auto &stats = import.result();
+        if (!stats)
+        {
+            co_return "ERR\tcannot open\n";
+        }
+        co_return "OK\t" + std::to_string(stats->added) + "\t" + std::to_string(stats->duplicates) + "\t" +
+            std::to_string(stats->malformed) + "\n";
+    }
+
+    static Task<std::string> exportJob(RosterManager &manager, std::string path, std::size_t limit, Wakeup &ready)
+    {
+        const auto format = exportFormatFor(path);
+        auto exporting = manager.exportHistoryAsync(std::move(path), format, limit, 4096, &ready);
+        while (exporting.step())
+        {
+            co_await std::suspend_always{};
+        }
+        co_return exporting.result() ? "OK\texported\n" : "ERR\tcannot write\n";
+    }
+
+    // A relative path without ".." segments, resolved under fileRoot_.
+    std::optional<std::string> resolveFile(std::string_view path) const
+    {
+        if (fileRoot_.empty() || path.empty() || path.front() == '/')
+        {
+            return std::nullopt;
+        }
+        for (std::string_view rest = path; !rest.empty();)
+        {
+            const auto slash = rest.find('/');
+            if (rest.substr(0, slash) == "..")
+            {
+                return std::nullopt;
+            }
+            rest = slash == std::string_view::npos ? std::string_view() : rest.substr(slash + 1);
+        }
+        return fileRoot_ + std::string(path);
+    }
+
+    bool writeTo(int fd)
+    {
+        auto &connection = connections_[fd];
+        while (connection.written < connection.output.size())
+        {
+            const auto n = ::send(fd, connection.output.data() + connection.written,
+                                  connection.output.size() - connection.written, MSG_NOSIGNAL);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (n < 0 && errno != EINTR)
+            {
+                closeConnection(fd);
+                return false;
+            }
+            if (n > 0)
+            {
+                connection.written += static_cast<std::size_t>(n);
+            }
+        }
+        const bool pending = connection.written < connection.output.size();
+        if (connection.paused && unsent(connection) <= outputLowWater)
+        {
+            connection.paused = false;
+            connection.output.erase(0, connection.written);
+            connection.written = 0;
+        }
+        if (!pending)
+        {
+            connection.output.clear();
+            connection.written = 0;
+            if (connection.closing && !connection.busy && connection.input.find('\n') == std::string::npos)
+            {
+                closeConnection(fd);
+                return false;
+            }
+        }
+        connection.wantsWrite = pending;
+        updateEvents(fd, connection);
+        return true;
+    }
+
+    void closeConnection(int fd)
+    {
+        ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections_.erase(fd);
+    }
+
+    static std::vector<std::string_view> splitFields(std::string_view line)
+    {
+        std::vector<std::string_view> fields;
+        while (true)
+        {
+            const auto tab = line.find('\t');
+            fields.push_back(line.substr(0, tab));
+            if (tab == std::string_view::npos)
+            {
+                return fields;
+            }
+            line.remove_prefix(tab + 1);
+        }
+    }
+
+    static std::optional<std::size_t> parseCount(std::string_view text)
+    {
+        std::size_t value = 0;
+        if (text.empty())
+        {
+            return std::nullopt;
+        }
+        for (const char c : text)
+        {
+            const auto digit = static_cast<std::size_t>(c - '0');
+            if (c < '0' || c > '9' || value > (std::numeric_limits<std::size_t>::max() - digit) / 10)
+            {
+                return std::nullopt;
+            }
+            value = value * 10 + digit;
+        }
+        return value;
+    }
+
+    void syncChanged()
+    {
+        alignas(inotify_event) std::array<char, 4096> buffer;
+        for (;;)
+        {
+            const auto length = ::read(inotifyFd_, buffer.data(), buffer.size());
+            if (length <= 0)
+            {
+                break;
+            }
+            for (std::size_t offset = 0; offset < static_cast<std::size_t>(length);)
+            {
+                const auto *event = reinterpret_cast<const inotify_event *>(buffer.data() + offset);
+                offset += sizeof(inotify_event) + event->len;
+                for (auto &watch : syncWatches_)
+                {
+                    if (event->len && watch.wd == event->wd && watch.file == event->name)
+                    {
+                        watch.pending = true;
+                    }
+                }
+            }
+        }
+        for (auto &watch : syncWatches_)
+        {
+            if (watch.pending)
+            {
+                watch.pending = false;
+                course(watch.course).syncFromFile(watch.path);
+            }
+        }
+    }
+
+    void dumpMetrics() const
+    {
+        std::vector<std::pair<std::string, MetricsReport>> reports;
+        for (const auto &[name, manager] : courses_)
+        {
+            std::string label = "course=\"";
+            for (const auto c : name)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    label.push_back('\\');
+                }
+                label.push_back(c == '\n' ? ' ' : c);
+            }
+            label.push_back('"');
+            reports.emplace_back(std::move(label), manager->metricsReport());
+        }
+        std::string text;
+        OutputBuffer out([&text](std::string_view data)
+                         {
+                             text.append(data);
+                             return true;
+                         });
+        writeMetrics(out, metricsPath_.ends_with(".bin") ? MetricsFormat::binary : MetricsFormat::prometheus, reports);
+        out.flush();
+        writeFileAtomically(metricsPath_, text);
+    }
+
+    RosterManager *findCourse(std::string_view name)
+    {
+        const auto it = courses_.find(std::string(name));
+        return it == courses_.end() ? nullptr : it->second.get();
+    }
+
+    static void appendStudent(std::string &out, const RosterManager &manager, const RosterManager::Student &student)
+    {
+        out.append("\t").append(manager.nameOf(student)).append("\t").append(manager.groupOf(student));
+    }
+
+    void handle(std::string_view line, int fd, Connection &connection)
+    {
+        auto &out = connection.output;
+        const auto fields = splitFields(line);
+        const auto command = fields[0];
+        if (fields.size() < 2)
+        {
+            out.append("ERR\tmissing course\n");
+            return;
+        }
+
+        if (command == "ADD")
+        {
+            if (fields.size() != 4 || fields[2].empty() || fields[3].empty())
+            {
+                out.append("ERR\tusage: ADD course name group\n");
+                return;
+            }
+            const bool added = course(std::string(fields[1])).addStudent(fields[2], fields[3]);
+            out.append(added ? "OK\tadded\n" : "OK\tduplicate\n");
+            return;
+        }
+
+        if (command == "IMPORT")
+        {
+            const auto path = fields.size() == 3 ? resolveFile(fields[2]) : std::nullopt;
+            if (!path)
+            {
+                out.append(fields.size() == 3 ? "ERR\tbad file\n" : "ERR\tusage: IMPORT course file\n");
+                return;
+            }
+            // A file that cannot be read must not leave an empty course behind.
+            if (!findCourse(fields[1]) && !std::ifstream(*path))
+            {
+                out.append("ERR\tcannot open\n");
+                return;
+            }
+            startJob(fd, connection, importJob(course(std::string(fields[1])), *path, jobsReady_));
+            return;
+        }
+
+        auto *manager = findCourse(fields[1]);
+        if (!manager)
+        {
+            out.append("ERR\tunknown course\n");
+            return;
+        }
+
+        if (command == "PICK" && fields.size() <= 3)
+        {
+            const auto idx = fields.size() == 3 ? manager->pickIndex(fields[2]) : manager->pickIndex();
+            if (!idx)
+            {
+                out.append("ERR\tempty\n");
+                return;
+            }
+            out.append("OK");
+            appendStudent(out, *manager, manager->student(*idx));
+            out.push_back('\n');
+        }
+        else if (command == "BATCH" && (fields.size() == 3 || fields.size() == 4))
+        {
+            const auto k = parseCount(fields[2]);
+            if (!k || *k > maxBatch)
+            {
+                out.append("ERR\tbad count\n");
+                return;
+            }
+            const auto picked = fields.size() == 4 ? manager->pickBatch(*k, fields[3]) : manager->pickBatch(*k);
+            out.append("OK\t").append(std::to_string(picked.size()));
+            for (const auto idx : picked)
+            {
+                appendStudent(out, *manager, manager->student(idx));
+            }
+            out.push_back('\n');
+        }
+        else if (command == "HISTORY" && fields.size() == 3)
+        {
+            const auto limit = parseCount(fields[2]);
+            if (!limit)
+            {
+                out.append("ERR\tbad limit\n");
+                return;
+            }
+            // The visitor runs under the manager's lock, so names are
+            // resolved only after it returns.
+            std::vector<RosterManager::CallRecord> records;
+            manager->forEachRecent(*limit, [&records](const RosterManager::CallRecord &record)
+                                   { records.push_back(record); });
+            out.append("OK\t").append(std::to_string(records.size()));
+            for (const auto &record : records)
+            {
+                out.append("\t").append(timestamps_.format(record.timestamp));
+                out.append("\t").append(manager->groupOf(record)).append("\t").append(manager->nameOf(record));
+            }
+            out.push_back('\n');
+        }
+        else if (command == "STATS" && fields.size() <= 3)
+        {
+            const auto top = fields.size() == 3 ? parseCount(fields[2]) : std::optional<std::size_t>{10};
+            if (!top)
+            {
+                out.append("ERR\tbad count\n");
+                return;
+            }
+            const auto ordered = manager->topCalled(*top);
+            out.append("OK\t").append(std::to_string(manager->studentCount()));
+            out.append("\t").append(std::to_string(manager->groupCount()));
+            out.append("\t").append(std::to_string(manager->historySize()));
+            for (const auto idx : ordered)
+            {
+                const auto student = manager->student(idx);
+                appendStudent(out, *manager, student);
+                out.append("\t").append(std::to_string(student.callCount));
+            }
+            out.push_back('\n');
+        }
+        else if (command == "EXPORT" && (fields.size() == 3 || fields.size() == 4))
+        {
+            const auto limit = fields.size() == 4 ? parseCount(fields[3]) : std::optional<std::size_t>{0};
+            const auto path = resolveFile(fields[2]);
+            if (!limit || !path)
+            {
+                out.append(limit ? "ERR\tbad file\n" : "ERR\tbad limit\n");
+                return;
+            }
+            startJob(fd, connection, exportJob(*manager, *path, *limit, jobsReady_));
+        }
+        else
+        {
+            out.append("ERR\tunknown command\n");
+        }
+    }
+
+    int listenFd_ = -1;
+    int epollFd_ = -1;
+    std::unordered_map<int, Connection> connections_;
+    std::unordered_map<std::string, std::unique_ptr<RosterManager>> courses_;
+    TimestampFormatter timestamps_;
+    std::string metricsPath_;
+    std::chrono::seconds metricsInterval_{10};
+    std::chrono::steady_clock::time_point nextMetricsDump_;
+    int inotifyFd_ = -1;
+    std::vector<SyncWatch> syncWatches_;
+    std::string fileRoot_;
+    std::uint64_t connectionCount_ = 0;
+    // The pipeline threads of every job notify this when a job can move on.
+    Wakeup jobsReady_;
+    // After courses_, so a job still running is torn down before its course.
+    std::vector<Job> jobs_;
+};
+#endif
+
+void printMenu()
+{
+    std::cout << "\n=== Random Roll Call System ===\n"
+              << "1. Add student\n"
+              << "2. Call random student\n"
+              << "3. Call by group\n"
+              << "4. Show history\n"
+              << "5. Show statistics\n"
+              << "6. Show groups\n"
+              << "7. Reset cycle\n"
+              << "8. Clear history\n"
+              << "9. Import from CSV\n"
+              << "10. Call batch\n"
+              << "11. Save snapshot\n"
+              << "12. Call weighted (favor least called)\n"
+              << "13. Remove student\n"
+              << "14. Move student to another group\n"
+              << "0. Exit\n"
+              << "Select: ";
+}
+
+#if defined(__linux__)
+volatile std::sig_atomic_t stopRequested = 0;
 
-    bool addStudent(const std::string &name, const std::string &group, bool refreshPools = true)
+// system --serve <port> [--files <dir>] [--course <name>=<roster.csv>]... [--sync <name>=<roster.csv>]...
+int runServer(int argc, char **argv)
+{
+    RosterServer server;
+    std::uint16_t port = 0;
+    for (int i = 1; i + 1 < argc; i += 2)
     {
-        auto duplicate = std::find_if(
-            students_.begin(), students_.end(),
-            [&](const Student &s)
-            { return s.name == name; });
-        if (duplicate != students_.end())
+        const std::string_view option = argv[i];
+        const std::string value = argv[i + 1];
+        if (option == "--serve")
         {
-            return false;
+            port = static_cast<std::uint16_t>(std::strtoul(value.c_str(), nullptr, 10));
         }
-
-        students_.push_back(Student{name, group, 0});
-        if (refreshPools)
+        else if (option == "--metrics")
         {
-            resetCycle();
+            server.setMetricsDump(value, std::chrono::seconds(10));
         }
-        return true;
-    }
-
-    std::optional<ImportStats> importFromFile(const std::string &path)
-    {
-        std::ifstream input(path);
-        if (!input.is_open())
+        else if (option == "--files")
         {
-            return std::nullopt;
+            server.setFileRoot(value);
+        }
+        else if (option == "--course" && value.find('=') != std::string::npos)
+        {
+            const auto split = value.find('=');
+            const auto name = value.substr(0, split);
+            const auto stats = server.course(name).importFromFile(value.substr(split + 1));
+            if (!stats)
+            {
+                std::cerr << "Failed to open roster for course " << name << ".\n";
+                return 1;
+            }
+            std::cout << "Course " << name << ": " << stats->added << " students.\n";
+        }
+        else if (option == "--sync" && value.find('=') != std::string::npos)
+        {
+            const auto split = value.find('=');
+            const auto name = value.substr(0, split);
+            const auto stats = server.syncCourse(name, value.substr(split + 1));
+            if (!stats)
+            {
+                std::cerr << "Failed to open roster for course " << name << ".\n";
+                return 1;
+            }
+            std::cout << "Course " << name << ": " << stats->added << " students, kept in sync.\n";
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " --serve <port> [--metrics <file>] [--files <dir>] [--course <name>=<roster.csv>]..."
+                         " [--sync <name>=<roster.csv>]...\n";
+            return 1;
         }
+    }
+    if (!port || !server.listen(port))
+    {
+        std::cerr << "Failed to listen on port " << port << ".\n";
+        return 1;
+    }
 
-        ImportStats stats;
-        loadFromStream(input, stats);
-        resetCycle();
-        return stats;
+    std::signal(SIGINT, [](int)
+                { stopRequested = 1; });
+    std::signal(SIGTERM, [](int)
+                { stopRequested = 1; });
+    std::cout << "Serving on port " << port << ".\n";
+    server.run(stopRequested);
+    return 0;
+}
+#endif
+
+// Runs commands without prompts against one manager that stays loaded for
+// the whole batch. Command-line options and script lines share one command
+// set: "--pick 5" on the command line is "pick 5" in a script. Picks are
+// printed as "name<TAB>group" lines.
+class BatchRunner
+{
+public:
+    BatchRunner()
+        : out_(OutputBuffer::streamSink(std::cout))
+    {
+        manager_.enableMetrics();
     }
 
-    std::optional<Student> pickRandom(const std::optional<std::string> &group = std::nullopt)
+    bool run(std::string_view command, std::string_view argument)
     {
-        if (students_.empty())
+        if (command == "seed")
         {
-            return std::nullopt;
+            const auto seed = parseNumber(argument);
+            if (!seed)
+            {
+                return fail("bad seed");
+            }
+            manager_.reseed(*seed);
         }
-
-        if (group)
+        else if (command == "import")
         {
-            if (groupPools_[*group].empty())
+            const auto stats = manager_.importFromFile(std::string(argument));
+            if (!stats)
             {
-                refillGroupPool(*group);
+                return fail("cannot open roster");
             }
-            if (groupPools_[*group].empty())
+            if (stats->malformed)
             {
-                return std::nullopt;
+                report("skipped " + std::to_string(stats->malformed) + " malformed lines");
             }
-            return consumeIndex(groupPools_[*group]);
         }
-
-        if (globalPool_.empty())
+        else if (command == "sync")
         {
-            refillGlobalPool();
+            const auto stats = manager_.syncFromFile(std::string(argument));
+            if (!stats)
+            {
+                return fail("cannot open roster");
+            }
+            if (stats->malformed)
+            {
+                report("skipped " + std::to_string(stats->malformed) + " malformed lines");
+            }
         }
-        if (globalPool_.empty())
+        else if (command == "add")
         {
-            return std::nullopt;
+            const auto split = argument.find(',');
+            if (split == std::string_view::npos || !split || split + 1 == argument.size())
+            {
+                return fail("expected name,group");
+            }
+            manager_.addStudent(argument.substr(0, split), argument.substr(split + 1));
         }
-        return consumeIndex(globalPool_);
-    }
-
-    void printHistory(std::size_t limit = 0) const
-    {
-        if (history_.empty())
+        else if (command == "remove")
         {
-            std::cout << "No history yet\n";
-            return;
+            if (!manager_.removeStudent(argument))
+            {
+                return fail("no such student");
+            }
         }
-
-        std::size_t count = 0;
-        for (auto it = history_.rbegin(); it != history_.rend(); ++it)
+        else if (command == "move")
         {
-            const auto time = std::chrono::system_clock::to_time_t(it->timestamp);
-            std::cout << std::put_time(std::localtime(&time), "%F %T")
-                      << " - " << it->group << " - " << it->name << '\n';
-            ++count;
-            if (limit && count >= limit)
+            const auto split = argument.find(',');
+            if (split == std::string_view::npos || !split || split + 1 == argument.size())
             {
-                break;
+                return fail("expected name,group");
+            }
+            if (!manager_.moveStudent(argument.substr(0, split), argument.substr(split + 1)))
+            {
+                return fail("no such student");
             }
         }
-    }
-
-    void printStats() const
-    {
-        if (students_.empty())
+        else if (command == "group")
         {
-            std::cout << "No student data\n";
-            return;
+            group_ = std::string(argument);
         }
-
-        std::vector<const Student *> ordered;
-        ordered.reserve(students_.size());
-        for (const auto &s : students_)
+        else if (command == "all")
         {
-            ordered.push_back(&s);
+            group_.reset();
         }
-        std::sort(ordered.begin(), ordered.end(), [](const Student *lhs, const Student *rhs)
-                  {
-            if (lhs->callCount == rhs->callCount) {
-                return lhs->name < rhs->name;
+        else if (command == "pick" || command == "weighted")
+        {
+            const auto count = parseNumber(argument);
+            if (!count || *count > RosterManager::maxBatchPicks)
+            {
+                return fail("bad count");
             }
-            return lhs->callCount > rhs->callCount; });
-
-        std::cout << std::left << std::setw(20) << "Name" << std::setw(15) << "Group" << "Count" << '\n';
-        for (const auto *s : ordered)
+            return command == "pick" ? pick(static_cast<std::size_t>(*count)) : pickWeighted(*count);
+        }
+        else if (command == "export" || command == "export-stats" || command == "export-groups")
         {
-            std::cout << std::left << std::setw(20) << s->name << std::setw(15) << s->group
-                      << s->callCount << '\n';
+            const auto path = std::string(argument);
+            const auto format = exportFormatFor(path);
+            const bool ok = command == "export"        ? manager_.exportHistory(path, format)
+                            : command == "export-stats" ? manager_.exportStats(path, format)
+                                                        : manager_.exportGroups(path, format);
+            if (!ok)
+            {
+                return fail("cannot write " + path);
+            }
         }
-    }
-
-    void listGroups() const
-    {
-        if (students_.empty())
+        else if (command == "history" || command == "stats" || command == "groups" || command == "report")
         {
-            std::cout << "No group data\n";
-            return;
+            // The count is optional for history and report, but must be a number when given.
+            const auto count = parseNumber(argument);
+            if ((command == "history" || command == "report") && !argument.empty() && !count)
+            {
+                return fail("bad count");
+            }
+            out_.flush();
+            if (command == "history")
+            {
+                manager_.printHistory(static_cast<std::size_t>(count.value_or(0)));
+            }
+            else if (command == "report")
+            {
+                manager_.printCallReport(static_cast<std::size_t>(count.value_or(10)));
+            }
+            else if (command == "stats")
+            {
+                manager_.printStats();
+            }
+            else
+            {
+                manager_.listGroups();
+            }
         }
-
-        std::unordered_map<std::string, int> counts;
-        for (const auto &s : students_)
+        else if (command == "reset")
         {
-            ++counts[s.group];
+            manager_.resetCycle();
         }
-        std::cout << "Groups:\n";
-        for (const auto &entry : counts)
+        else if (command == "clear-history")
         {
-            std::cout << "- " << entry.first << " (" << entry.second << ")\n";
+            manager_.clearHistory();
         }
+        else if (command == "load" || command == "save")
+        {
+            const auto path = std::string(argument);
+            if (!(command == "load" ? manager_.loadSnapshot(path) : manager_.saveSnapshot(path)))
+            {
+                return fail("cannot " + std::string(command) + " " + path);
+            }
+        }
+        else if (command == "metrics")
+        {
+            const auto path = std::string(argument);
+            if (!manager_.exportMetrics(path, path.ends_with(".bin") ? MetricsFormat::binary : MetricsFormat::prometheus))
+            {
+                return fail("cannot write " + path);
+            }
+        }
+        else if (command == "script")
+        {
+            return runScript(std::string(argument));
+        }
+        else
+        {
+            return fail("unknown command '" + std::string(command) + "'");
+        }
+        return true;
     }
 
-    void resetCycle()
-    {
-        globalPool_.clear();
-        groupPools_.clear();
-    }
-
-    void clearHistory()
+    // Maps the whole script (or reads all of stdin for "-") before running
+    // it. One command per line, its argument after the first space; blank
+    // lines and lines starting with '#' are skipped.
+    bool runScript(const std::string &path)
     {
-        history_.clear();
+        if (std::find(activeScripts_.begin(), activeScripts_.end(), path) != activeScripts_.end())
+        {
+            return fail("script " + path + " includes itself");
+        }
+        if (activeScripts_.size() >= maxScriptDepth)
+        {
+            return fail("scripts nested too deeply at " + path);
+        }
+        activeScripts_.push_back(path);
+        const bool ok = runScriptLines(path);
+        activeScripts_.pop_back();
+        return ok;
     }
 
-private:
-    void loadFromStream(std::istream &input, ImportStats &stats)
+    bool runScriptLines(const std::string &path)
     {
-        std::string line;
-        while (std::getline(input, line))
+        std::string input;
+        std::optional<MappedFile> file;
+        std::string_view text;
+        if (path == "-")
+        {
+            input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+            text = input;
+        }
+        else
         {
-            const auto trimmed = trim(line);
-            if (trimmed.empty() || trimmed.front() == '#')
+            file.emplace(path);
+            if (!file->isOpen())
             {
-                continue;
+                return fail("cannot open script " + path);
             }
+            text = file->view();
+        }
 
-            const auto comma = trimmed.find(',');
-            if (comma == std::string::npos)
+        const auto outerLocation = location_;
+        std::size_t lineNumber = 0;
+        while (!text.empty())
+        {
+            const auto end = text.find('\n');
+            auto line = text.substr(0, end);
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+            ++lineNumber;
+            if (!line.empty() && line.back() == '\r')
             {
-                ++stats.malformed;
-                continue;
+                line.remove_suffix(1);
             }
-
-            auto name = trim(trimmed.substr(0, comma));
-            auto group = trim(trimmed.substr(comma + 1));
-            if (name.empty() || group.empty())
+            if (line.empty() || line.front() == '#')
             {
-                ++stats.malformed;
                 continue;
             }
-
-            if (addStudent(name, group, false))
-            {
-                ++stats.added;
-            }
-            else
+            const auto split = line.find(' ');
+            location_ = path + ":" + std::to_string(lineNumber);
+            if (!run(line.substr(0, split), split == std::string_view::npos ? std::string_view{} : line.substr(split + 1)))
             {
-                ++stats.duplicates;
+                return false;
             }
         }
+        location_ = outerLocation;
+        return true;
     }
 
-    static std::string trim(const std::string &text)
+    void setLocation(std::string location)
     {
-        const auto first = text.find_first_not_of(" \t\r\n");
-        if (first == std::string::npos)
-        {
-            return {};
-        }
-        const auto last = text.find_last_not_of(" \t\r\n");
-        return text.substr(first, last - first + 1);
+        location_ = std::move(location);
     }
 
-    Student consumeIndex(std::deque<std::size_t> &pool)
+    bool finish()
     {
-        const auto idx = pool.front();
-        pool.pop_front();
-        auto &student = students_[idx];
-        ++student.callCount;
-        history_.push_back(CallRecord{student.name, student.group, std::chrono::system_clock::now()});
-        return student;
+        return out_.flush();
     }
 
-    void refillGlobalPool()
+private:
+    bool pick(std::size_t count)
     {
-        std::vector<std::size_t> indices(students_.size());
-        std::iota(indices.begin(), indices.end(), 0);
-        std::shuffle(indices.begin(), indices.end(), rng_);
-        globalPool_.assign(indices.begin(), indices.end());
+        const auto picked = group_ ? manager_.pickBatch(count, std::string_view{*group_}) : manager_.pickBatch(count);
+        if (picked.empty() && count)
+        {
+            return fail(group_ ? "group '" + *group_ + "' not found or empty" : "no students available");
+        }
+        for (const auto idx : picked)
+        {
+            printStudent(manager_.student(idx));
+        }
+        return true;
     }
 
-    void refillGroupPool(const std::string &group)
+    bool pickWeighted(std::uint64_t count)
     {
-        std::vector<std::size_t> indices;
-        for (std::size_t i = 0; i < students_.size(); ++i)
+        if (!weighted_)
+        {
+            manager_.setSelectionStrategy(std::make_unique<LeastCalledStrategy>());
+            weighted_ = true;
+        }
+        for (std::uint64_t i = 0; i < count; ++i)
         {
-            if (students_[i].group == group)
+            const auto idx = group_ ? manager_.pickWeighted(*group_) : manager_.pickWeighted();
+            if (!idx)
             {
-                indices.push_back(i);
+                return fail(group_ ? "group '" + *group_ + "' not found or empty" : "no students available");
             }
+            printStudent(manager_.student(*idx));
         }
-        if (indices.empty())
+        return true;
+    }
+
+    void printStudent(const RosterManager::Student &student)
+    {
+        out_.append(manager_.nameOf(student));
+        out_.push_back('\t');
+        out_.append(manager_.groupOf(student));
+        out_.push_back('\n');
+    }
+
+    static std::optional<std::uint64_t> parseNumber(std::string_view text)
+    {
+        std::uint64_t value = 0;
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error != std::errc{} || end != text.data() + text.size())
         {
-            groupPools_.erase(group);
-            return;
+            return std::nullopt;
         }
-        std::shuffle(indices.begin(), indices.end(), rng_);
-        groupPools_[group].assign(indices.begin(), indices.end());
+        return value;
+    }
+
+    void report(const std::string &message)
+    {
+        out_.flush();
+        std::cerr << location_ << ": " << message << '\n';
+    }
+
+    bool fail(const std::string &message)
+    {
+        report(message);
+        return false;
     }
 
-    std::vector<Student> students_;
-    std::unordered_map<std::string, std::deque<std::size_t>> groupPools_;
-    std::deque<std::size_t> globalPool_;
-    std::list<CallRecord> history_;
-    std::mt19937 rng_;
+    RosterManager manager_;
+    OutputBuffer out_;
+    std::optional<std::string> group_;
+    std::string location_;
+    bool weighted_ = false;
+    // Scripts being run, outermost first, to catch a script that includes
+    // itself (the depth cap catches loops through other names for it).
+    std::vector<std::string> activeScripts_;
+    static constexpr std::size_t maxScriptDepth = 32;
 };
 
-void printMenu()
+// Every "--command [argument]" pair runs in order; see BatchRunner.
+int runBatch(int argc, char **argv)
 {
-    std::cout << "\n=== Random Roll Call System ===\n"
-              << "1. Add student\n"
-              << "2. Call random student\n"
-              << "3. Call by group\n"
-              << "4. Show history\n"
-              << "5. Show statistics\n"
-              << "6. Show groups\n"
-              << "7. Reset cycle\n"
-              << "8. Clear history\n"
-              << "9. Import from CSV\n"
-              << "0. Exit\n"
-              << "Select: ";
+    static constexpr std::array<std::string_view, 7> flags{"all",    "reset",   "clear-history", "stats",
+                                                           "groups", "history", "report"};
+    std::ios::sync_with_stdio(false);
+    BatchRunner runner;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view option = argv[i];
+        if (!option.starts_with("--"))
+        {
+            std::cerr << "Usage: " << argv[0] << " [--import <csv>] [--group <name>] [--pick <n>] "
+                      << "[--export <file.csv|.jsonl|.bin>] [--script <file|->] ...\n";
+            return 1;
+        }
+        option.remove_prefix(2);
+        std::string_view argument;
+        const bool takesArgument = std::find(flags.begin(), flags.end(), option) == flags.end();
+        const bool hasNext = i + 1 < argc && !std::string_view(argv[i + 1]).starts_with("--");
+        if ((takesArgument && i + 1 < argc) || ((option == "history" || option == "report") && hasNext))
+        {
+            argument = argv[++i];
+        }
+        runner.setLocation(std::string("--") + std::string(option));
+        if (!runner.run(option, argument))
+        {
+            runner.finish();
+            return 1;
+        }
+    }
+    return runner.finish() ? 0 : 1;
 }
 
-int main()
+#if !defined(ROSTER_NO_MAIN)
+int main(int argc, char **argv)
 {
+#if defined(__linux__)
+    if (argc > 1 && std::string_view(argv[1]) == "--serve")
+    {
+        return runServer(argc, argv);
+    }
+#endif
+    if (argc > 1)
+    {
+        return runBatch(argc, argv);
+    }
     RosterManager manager;
     const std::string defaultRoster = "roster.csv";
-    if (auto stats = manager.importFromFile(defaultRoster))
+    const std::string defaultSnapshot = "roster.snap";
+    if (manager.loadSnapshot(defaultSnapshot))
+    {
+        std::cout << "Restored previous session from " << defaultSnapshot << ".\n";
+    }
+    else if (auto stats = manager.importFromFile(defaultRoster))
     {
         std::cout << "Loaded default roster from " << defaultRoster << ". Added "
                   << stats->added << ", duplicates " << stats->duplicates
@@ -309,7 +7064,20 @@ int main()
     {
         std::cout << "No default roster found. Use option 9 to import manually.\n";
     }
+    const std::string defaultWal = "roster.wal";
+    if (const auto replayed = manager.openWal(defaultWal, defaultSnapshot))
+    {
+        if (*replayed)
+        {
+            std::cout << "Recovered " << *replayed << " calls from " << defaultWal << ".\n";
+        }
+    }
+    else
+    {
+        std::cout << "Call log unavailable; calls are only saved on exit.\n";
+    }
     bool running = true;
+    bool weighted = false;
 
     while (running)
     {
@@ -351,10 +7119,10 @@ int main()
         }
         case 2:
         {
-            auto student = manager.pickRandom();
-            if (student)
+            if (const auto idx = manager.pickIndex())
             {
-                std::cout << "Selected: " << student->name << " (" << student->group << ")\n";
+                const auto student = manager.student(*idx);
+                std::cout << "Selected: " << manager.nameOf(student) << " (" << manager.groupOf(student) << ")\n";
             }
             else
             {
@@ -372,10 +7140,10 @@ int main()
                 std::cout << "Group name cannot be empty.\n";
                 break;
             }
-            auto student = manager.pickRandom(std::optional<std::string>{group});
-            if (student)
+            if (const auto idx = manager.pickIndex(group))
             {
-                std::cout << "Selected: " << student->name << " (" << student->group << ")\n";
+                const auto student = manager.student(*idx);
+                std::cout << "Selected: " << manager.nameOf(student) << " (" << manager.groupOf(student) << ")\n";
             }
             else
             {
@@ -429,6 +7197,102 @@ int main()
                       << result->malformed << " malformed lines.\n";
             break;
         }
+        case 10:
+        {
+            std::string text;
+            std::cout << "How many students: ";
+            std::getline(std::cin, text);
+            std::size_t count = 0;
+            const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), count);
+            if (error != std::errc{} || end != text.data() + text.size() || !count ||
+                count > RosterManager::maxBatchPicks)
+            {
+                std::cout << "Invalid count.\n";
+                break;
+            }
+            std::string group;
+            std::cout << "Group to call (empty = all): ";
+            std::getline(std::cin, group);
+            const auto picked = group.empty() ? manager.pickBatch(count)
+                                              : manager.pickBatch(count, std::string_view{group});
+            if (picked.empty())
+            {
+                std::cout << "No students available.\n";
+                break;
+            }
+            for (const auto idx : picked)
+            {
+                const auto student = manager.student(idx);
+                std::cout << "Selected: " << manager.nameOf(student) << " (" << manager.groupOf(student) << ")\n";
+            }
+            break;
+        }
+        case 11:
+            if (manager.checkpoint() || manager.saveSnapshot(defaultSnapshot))
+            {
+                std::cout << "Snapshot saved to " << defaultSnapshot << ".\n";
+            }
+            else
+            {
+                std::cout << "Failed to save snapshot.\n";
+            }
+            break;
+        case 12:
+        {
+            if (!weighted)
+            {
+                manager.setSelectionStrategy(std::make_unique<LeastCalledStrategy>());
+                weighted = true;
+            }
+            if (const auto idx = manager.pickWeighted())
+            {
+                const auto student = manager.student(*idx);
+                std::cout << "Selected: " << manager.nameOf(student) << " (" << manager.groupOf(student) << ")\n";
+            }
+            else
+            {
+                std::cout << "No students available.\n";
+            }
+            break;
+        }
+        case 13:
+        {
+            std::string name;
+            std::cout << "Student name: ";
+            std::getline(std::cin, name);
+            if (manager.removeStudent(name))
+            {
+                std::cout << "Student removed.\n";
+            }
+            else
+            {
+                std::cout << "No such student.\n";
+            }
+            break;
+        }
+        case 14:
+        {
+            std::string name;
+            std::string group;
+            std::cout << "Student name: ";
+            std::getline(std::cin, name);
+            std::cout << "New group name: ";
+            std::getline(std::cin, group);
+            if (group.empty())
+            {
+                std::cout << "Group name cannot be empty.\n";
+                break;
+            }
+            if (manager.moveStudent(name, group))
+            {
+                std::cout << "Student moved.\n";
+            }
+            else
+            {
+                std::cout << "No such student.\n";
+            }
+            break;
+        }
         case 0:
             running = false;
             break;
@@ -436,8 +7300,14 @@ int main()
             std::cout << "Unknown option.\n";
             break;
         }
+        manager.flushWal();
     }
 
+    if (!manager.checkpoint() && !manager.saveSnapshot(defaultSnapshot))
+    {
+        std::cout << "Failed to save snapshot.\n";
+    }
     std::cout << "Goodbye!\n";
     return 0;
 }
+#endif
@@ -0,0 +1,778 @@
+// GoogleTest checks for RosterManager and RosterServer. Build from the
+// repository root:
+//
+//     g++ -std=c++20 -O2 -pthread tests/roster_tests.cpp -lgtest -lgtest_main -o roster_tests
+#define ROSTER_NO_MAIN
+#include "../system.cpp"
+#undef ROSTER_NO_MAIN
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <thread>
+
+namespace
+{
+
+// A fresh directory under the temp directory, removed with everything in it.
+class TempDir
+{
+public:
+    TempDir()
+        : path_(std::filesystem::temp_directory_path() /
+                ("roster_tests_" + std::to_string(::getpid()) + "_" + std::to_string(++count_)))
+    {
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+    }
+
+    ~TempDir()
+    {
+        std::error_code error;
+        std::filesystem::remove_all(path_, error);
+    }
+
+    std::string file(const std::string &name) const
+    {
+        return (path_ / name).string();
+    }
+
+    std::string write(const std::string &name, const std::string &text) const
+    {
+        writeFileAtomically(file(name), text);
+        return file(name);
+    }
+
+    static std::string read(const std::string &path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    }
+
+private:
+    static inline int count_ = 0;
+    std::filesystem::path path_;
+};
+
+std::string rosterCsv(std::size_t students, std::size_t groups)
+{
+    std::string text;
+    for (std::size_t i = 0; i < students; ++i)
+    {
+        text.append("Student").append(std::to_string(i));
+        text.append(",Group").append(std::to_string(i % groups)).push_back('\n');
+    }
+    return text;
+}
+
+template <typename Export>
+std::string exported(Export &&write)
+{
+    std::string text;
+    OutputBuffer out([&text](std::string_view data)
+                     {
+                         text.append(data);
+                         return true;
+                     });
+    write(out);
+    out.flush();
+    return text;
+}
+
+std::string statsOf(const RosterManager &manager)
+{
+    return exported([&](OutputBuffer &out) { manager.exportStats(out, ExportFormat::csv); });
+}
+
+std::string historyOf(const RosterManager &manager)
+{
+    return exported([&](OutputBuffer &out) { manager.exportHistory(out, ExportFormat::binary); });
+}
+
+std::optional<std::string> groupOf(const RosterManager &manager, std::string_view name)
+{
+    const auto idx = manager.findStudent(name);
+    return idx ? std::optional<std::string>(manager.groupOf(manager.student(*idx))) : std::nullopt;
+}
+
+TEST(SnapshotWal, ReplayRestoresThePickedState)
+{
+    TempDir dir;
+    const auto roster = dir.write("roster.csv", rosterCsv(200, 7));
+    RosterManager live(std::uint64_t{11});
+    ASSERT_TRUE(live.importFromFile(roster));
+    ASSERT_EQ(live.openWal(dir.file("roster.wal"), dir.file("roster.snap")), std::size_t{0});
+    for (int i = 0; i < 150; ++i)
+    {
+        live.pickIndex();
+    }
+    live.pickBatch(300);
+    live.pickBatch(20, "Group3");
+    live.flushWal();
+
+    RosterManager restored(std::uint64_t{0});
+    ASSERT_TRUE(restored.loadSnapshot(dir.file("roster.snap")));
+    EXPECT_EQ(restored.openWal(dir.file("roster.wal"), dir.file("restored.snap")), std::size_t{470});
+    EXPECT_EQ(statsOf(restored), statsOf(live));
+    EXPECT_EQ(historyOf(restored), historyOf(live));
+    EXPECT_EQ(restored.pickBatch(250), live.pickBatch(250));
+    EXPECT_EQ(restored.pickBatch(9, "Group5"), live.pickBatch(9, "Group5"));
+}
+
+TEST(SnapshotWal, LogCoveredBySnapshotReplaysNothing)
+{
+    TempDir dir;
+    const auto roster = dir.write("roster.csv", rosterCsv(50, 3));
+    RosterManager live(std::uint64_t{5});
+    ASSERT_TRUE(live.importFromFile(roster));
+    ASSERT_TRUE(live.openWal(dir.file("roster.wal"), dir.file("roster.snap")));
+    live.pickBatch(40);
+    live.flushWal();
+    ASSERT_TRUE(live.saveSnapshot(dir.file("covered.snap")));
+
+    RosterManager restored(std::uint64_t{0});
+    ASSERT_TRUE(restored.loadSnapshot(dir.file("covered.snap")));
+    EXPECT_EQ(restored.openWal(dir.file("roster.wal"), dir.file("restored.snap")), std::size_t{0});
+    EXPECT_EQ(statsOf(restored), statsOf(live));
+    EXPECT_EQ(restored.pickBatch(30), live.pickBatch(30));
+}
+
+TEST(SnapshotWal, RosterChangesAreLoggedInsteadOfCheckpointed)
+{
+    TempDir dir;
+    const auto roster = dir.write("roster.csv", rosterCsv(120, 5));
+    RosterManager live(std::uint64_t{21});
+    ASSERT_TRUE(live.importFromFile(roster));
+    ASSERT_TRUE(live.openWal(dir.file("roster.wal"), dir.file("roster.snap")));
+    const auto snapshotTime = std::filesystem::last_write_time(dir.file("roster.snap"));
+
+    live.pickBatch(130);
+    ASSERT_TRUE(live.addStudent("Newcomer with a long name", "Brand new group"));
+    live.pickBatch(4, "Brand new group");
+    ASSERT_TRUE(live.removeStudent("Student7"));
+    ASSERT_TRUE(live.moveStudent("Student8", "Another new group"));
+    live.pickBatch(60);
+    for (int i = 0; i < 90; ++i)
+    {
+        live.removeStudent("Student" + std::to_string(i + 20));
+    }
+    const auto path = dir.write("sync.csv", "Student1,Group9\nSynced,Group0\nSynced,Group8\n");
+    ASSERT_TRUE(live.syncFromFile(path));
+    live.pickBatch(20, "Group0");
+    live.pickBatch(45);
+    live.flushWal();
+    EXPECT_EQ(std::filesystem::last_write_time(dir.file("roster.snap")), snapshotTime);
+
+    RosterManager restored(std::uint64_t{0});
+    ASSERT_TRUE(restored.loadSnapshot(dir.file("roster.snap")));
+    ASSERT_TRUE(restored.openWal(dir.file("roster.wal"), dir.file("restored.snap")));
+    EXPECT_EQ(statsOf(restored), statsOf(live));
+    EXPECT_EQ(historyOf(restored), historyOf(live));
+    EXPECT_EQ(restored.groupCount(), live.groupCount());
+    EXPECT_EQ(restored.pickBatch(80), live.pickBatch(80));
+    EXPECT_EQ(restored.pickBatch(3, "Another new group"), live.pickBatch(3, "Another new group"));
+}
+
+TEST(SnapshotWal, LongLogCheckpointsOnTheNextRosterChange)
+{
+    TempDir dir;
+    RosterManager live(std::uint64_t{2});
+    ASSERT_TRUE(live.importFromFile(dir.write("roster.csv", rosterCsv(10, 2))));
+    WalOptions options;
+    options.checkpointRecords = 50;
+    ASSERT_TRUE(live.openWal(dir.file("roster.wal"), dir.file("roster.snap"), options));
+    live.pickBatch(40);
+    ASSERT_TRUE(live.addStudent("a", "Group0"));
+    live.flushWal();
+    const auto logged = std::filesystem::file_size(dir.file("roster.wal"));
+    live.pickBatch(20);
+    ASSERT_TRUE(live.addStudent("b", "Group0"));
+    live.flushWal();
+    EXPECT_LT(std::filesystem::file_size(dir.file("roster.wal")), logged);
+}
+
+TEST(Sync, FullDiffAddsRemovesAndMoves)
+{
+    TempDir dir;
+    RosterManager manager(std::uint64_t{1});
+    const auto path = dir.write("sync.csv", "a,g1\nb,g1\nc,g2\n");
+    auto stats = manager.syncFromFile(path);
+    ASSERT_TRUE(stats);
+    EXPECT_EQ(stats->added, 3u);
+
+    dir.write("sync.csv", "a,g2\nc,g2\nd,g3\n");
+    stats = manager.syncFromFile(path);
+    ASSERT_TRUE(stats);
+    EXPECT_FALSE(stats->incremental);
+    EXPECT_EQ(stats->added, 1u);
+    EXPECT_EQ(stats->removed, 1u);
+    EXPECT_EQ(stats->moved, 1u);
+    EXPECT_EQ(groupOf(manager, "a"), "g2");
+    EXPECT_EQ(groupOf(manager, "b"), std::nullopt);
+    EXPECT_EQ(manager.studentCount(), 3u);
+}
+
+TEST(Sync, AppendedLinesAreParsedIncrementally)
+{
+    TempDir dir;
+    RosterManager manager(std::uint64_t{1});
+    const auto path = dir.write("sync.csv", "a,g1\nb,g1\n");
+    ASSERT_TRUE(manager.syncFromFile(path));
+    dir.write("sync.csv", "a,g1\nb,g1\nc,g2\nbroken\n");
+    const auto stats = manager.syncFromFile(path);
+    ASSERT_TRUE(stats);
+    EXPECT_TRUE(stats->incremental);
+    EXPECT_EQ(stats->added, 1u);
+    EXPECT_EQ(stats->malformed, 1u);
+    EXPECT_EQ(manager.studentCount(), 3u);
+}
+
+TEST(Sync, NewRowMovesAStudentAlreadyOnTheRoster)
+{
+    TempDir dir;
+    RosterManager manager(std::uint64_t{1});
+    ASSERT_TRUE(manager.addStudent("b", "g1"));
+    const auto path = dir.write("sync.csv", "a,g1\nb,g2\n");
+    auto stats = manager.syncFromFile(path);
+    ASSERT_TRUE(stats);
+    EXPECT_EQ(stats->moved, 1u);
+    EXPECT_EQ(stats->duplicates, 0u);
+    EXPECT_EQ(groupOf(manager, "b"), "g2");
+
+    dir.write("sync.csv", "a,g1\nb,g3\n");
+    ASSERT_TRUE(manager.syncFromFile(path));
+    EXPECT_EQ(groupOf(manager, "b"), "g3");
+}
+
+TEST(Sync, StudentRemovedByHandStaysRemovedUntilTheRowReturns)
+{
+    TempDir dir;
+    RosterManager manager(std::uint64_t{1});
+    const auto path = dir.write("sync.csv", "a,g1\nb,g1\n");
+    ASSERT_TRUE(manager.syncFromFile(path));
+    ASSERT_TRUE(manager.removeStudent("b"));
+
+    dir.write("sync.csv", "b,g1\na,g1\n");
+    ASSERT_TRUE(manager.syncFromFile(path));
+    EXPECT_EQ(groupOf(manager, "b"), std::nullopt);
+
+    dir.write("sync.csv", "a,g1\n");
+    ASSERT_TRUE(manager.syncFromFile(path));
+    dir.write("sync.csv", "a,g1\nb,g1\n");
+    ASSERT_TRUE(manager.syncFromFile(path));
+    EXPECT_EQ(groupOf(manager, "b"), "g1");
+}
+
+TEST(RosterChanges, CyclesSurviveRemovalsMovesAndCompaction)
+{
+    RosterManager manager(std::uint64_t{9});
+    for (int i = 0; i < 40; ++i)
+    {
+        manager.addStudent("Student" + std::to_string(i), "Group" + std::to_string(i % 4));
+    }
+    const auto nameAt = [&](std::size_t idx) { return std::string(manager.nameOf(manager.student(idx))); };
+    std::set<std::string> called;
+    for (int i = 0; i < 12; ++i)
+    {
+        called.insert(nameAt(*manager.pickIndex()));
+    }
+    std::set<std::string> calledInGroup1;
+    for (int i = 0; i < 3; ++i)
+    {
+        calledInGroup1.insert(nameAt(*manager.pickIndex("Group1")));
+    }
+
+    // Group1 keeps its members, so its half-done cycle can be checked too.
+    const auto rows = manager.rowCount();
+    std::set<std::string> live;
+    for (int i = 0; i < 40; ++i)
+    {
+        const auto name = "Student" + std::to_string(i);
+        if (i % 4 == 1 || i % 6 == 0)
+        {
+            live.insert(name);
+        }
+        else
+        {
+            ASSERT_TRUE(manager.removeStudent(name));
+        }
+    }
+    EXPECT_LT(manager.rowCount(), rows);
+    ASSERT_EQ(manager.studentCount(), live.size());
+    ASSERT_TRUE(manager.moveStudent("Student0", "Group3"));
+    ASSERT_TRUE(manager.moveStudent("Student6", "Group3"));
+
+    std::set<std::string> rest;
+    for (const auto &name : live)
+    {
+        if (!called.count(name))
+        {
+            rest.insert(name);
+        }
+    }
+    std::set<std::string> picked;
+    for (std::size_t i = 0; i < rest.size(); ++i)
+    {
+        picked.insert(nameAt(*manager.pickIndex()));
+    }
+    EXPECT_EQ(picked, rest);
+
+    std::set<std::string> group1Rest;
+    for (int i = 1; i < 40; i += 4)
+    {
+        const auto name = "Student" + std::to_string(i);
+        if (!calledInGroup1.count(name))
+        {
+            group1Rest.insert(name);
+        }
+    }
+    std::set<std::string> group1Picked;
+    for (std::size_t i = 0; i < group1Rest.size(); ++i)
+    {
+        group1Picked.insert(nameAt(*manager.pickIndex("Group1")));
+    }
+    EXPECT_EQ(group1Picked, group1Rest);
+
+    manager.resetCycle();
+    std::set<std::string> group3;
+    for (int i = 0; i < 2; ++i)
+    {
+        group3.insert(nameAt(*manager.pickIndex("Group3")));
+    }
+    EXPECT_EQ(group3, (std::set<std::string>{"Student0", "Student6"}));
+}
+
+TEST(Leaderboard, MatchesASortOfTheRoster)
+{
+    TempDir dir;
+    RosterManager manager(std::uint64_t{3});
+    ASSERT_TRUE(manager.importFromFile(dir.write("roster.csv", rosterCsv(300, 4))));
+    manager.pickBatch(700);
+    for (int i = 0; i < 200; ++i)
+    {
+        manager.pickIndex("Group1");
+    }
+    for (int i = 0; i < 300; i += 7)
+    {
+        manager.removeStudent("Student" + std::to_string(i));
+    }
+    manager.pickBatch(90);
+
+    std::vector<std::size_t> expected;
+    for (std::size_t idx = 0; idx < manager.rowCount(); ++idx)
+    {
+        const auto student = manager.student(idx);
+        if (manager.findStudent(manager.nameOf(student)) == idx)
+        {
+            expected.push_back(idx);
+        }
+    }
+    const auto descending = [&](std::size_t lhs, std::size_t rhs)
+    {
+        const auto a = manager.student(lhs);
+        const auto b = manager.student(rhs);
+        return a.callCount != b.callCount ? a.callCount > b.callCount : manager.nameOf(a) < manager.nameOf(b);
+    };
+    std::sort(expected.begin(), expected.end(), descending);
+    EXPECT_EQ(manager.topCalled(expected.size()), expected);
+    EXPECT_EQ(manager.topCalled(10), std::vector<std::size_t>(expected.begin(), expected.begin() + 10));
+
+    const auto ascending = [&](std::size_t lhs, std::size_t rhs)
+    {
+        const auto a = manager.student(lhs);
+        const auto b = manager.student(rhs);
+        return a.callCount != b.callCount ? a.callCount < b.callCount : manager.nameOf(a) < manager.nameOf(b);
+    };
+    std::sort(expected.begin(), expected.end(), ascending);
+    EXPECT_EQ(manager.leastCalled(25), std::vector<std::size_t>(expected.begin(), expected.begin() + 25));
+}
+
+TEST(CallReport, HistogramsHoldOnlyTheCountsThatOccur)
+{
+    RosterManager manager(std::uint64_t{1});
+    manager.addStudent("a", "solo");
+    manager.addStudent("b", "pair");
+    manager.addStudent("c", "pair");
+    for (int i = 0; i < 100000; ++i)
+    {
+        manager.pickIndex("solo");
+    }
+    manager.pickIndex("pair");
+
+    const auto report = manager.callReport(0, 2);
+    using Histogram = std::vector<std::pair<int, std::size_t>>;
+    EXPECT_EQ(report.overall.histogram, (Histogram{{0, 1}, {1, 1}, {100000, 1}}));
+    ASSERT_EQ(report.groups.size(), 2u);
+    EXPECT_EQ(report.groups[0].calls.histogram, (Histogram{{100000, 1}}));
+    EXPECT_EQ(report.groups[1].calls.histogram, (Histogram{{0, 1}, {1, 1}}));
+}
+
+TEST(CompactHistory, RecordsComeBackToTheMillisecondThroughEviction)
+{
+    using namespace std::chrono_literals;
+    using CallRecord = RosterManager::CallRecord;
+    const auto start = std::chrono::system_clock::time_point(1'700'000'000'000'123'456ns);
+    // Every 97th record jumps 40 days either way, past a 32-bit offset.
+    const auto expected = [&](std::size_t i)
+    {
+        auto time = start + i * 1ms + std::chrono::microseconds(i % 1000);
+        if (i % 97 == 0)
+        {
+            time += i % 2 ? 960h : -960h;
+        }
+        return CallRecord{static_cast<StringTable::Id>(i), static_cast<StringTable::Id>(i % 7),
+                          std::chrono::floor<std::chrono::milliseconds>(time)};
+    };
+    const auto same = [](const CallRecord &lhs, const CallRecord &rhs)
+    { return lhs.nameId == rhs.nameId && lhs.groupId == rhs.groupId && lhs.timestamp == rhs.timestamp; };
+
+    CompactHistory<CallRecord> history;
+    std::vector<CallRecord> evicted;
+    history.setEvictionHandler([&](const CallRecord *records, std::size_t count)
+                               { evicted.insert(evicted.end(), records, records + count); });
+    history.setRetention(5000);
+    constexpr std::size_t total = 20000;
+    for (std::size_t i = 0; i < total; ++i)
+    {
+        auto record = expected(i);
+        record.timestamp += 789us;
+        history.push_back(record);
+    }
+
+    ASSERT_EQ(history.size(), std::size_t{5000});
+    EXPECT_EQ(history.firstSequence(), total - 5000);
+    EXPECT_EQ(history.nextSequence(), total);
+    for (std::size_t i = 0; i < history.size(); ++i)
+    {
+        ASSERT_TRUE(same(history[i], expected(total - 5000 + i))) << i;
+    }
+    EXPECT_TRUE(same(history.fromBack(0), expected(total - 1)));
+    ASSERT_EQ(evicted.size(), total - 5000);
+    for (std::size_t i = 0; i < evicted.size(); ++i)
+    {
+        ASSERT_TRUE(same(evicted[i], expected(i))) << i;
+    }
+
+    history.setRetention(100);
+    ASSERT_EQ(history.size(), std::size_t{100});
+    EXPECT_EQ(evicted.size(), total - 100);
+    for (std::size_t i = 0; i < history.size(); ++i)
+    {
+        ASSERT_TRUE(same(history[i], expected(total - 100 + i))) << i;
+    }
+}
+
+TEST(HistoryIndex, EvictedCallsAreSweptFromKeysNoLongerCalled)
+{
+    RosterManager manager(std::uint64_t{4});
+    for (int i = 0; i < 400; ++i)
+    {
+        manager.addStudent("Student" + std::to_string(i), "Group" + std::to_string(i % 40));
+    }
+    ASSERT_TRUE(manager.setHistoryRetention(1000));
+    std::uint64_t steady = 0;
+    for (int group = 0; group < 40; ++group)
+    {
+        for (int i = 0; i < 3000; ++i)
+        {
+            manager.pickIndex("Group" + std::to_string(group));
+        }
+        if (group == 1)
+        {
+            steady = manager.metricsReport().historyBytes;
+        }
+    }
+    EXPECT_LE(manager.metricsReport().historyBytes, steady);
+    EXPECT_TRUE(manager.callsForGroup("Group0").empty());
+    EXPECT_EQ(manager.callsForGroup("Group39").size(), std::size_t{1000});
+
+    ASSERT_TRUE(manager.setHistoryRetention(10));
+    EXPECT_EQ(manager.callsForGroup("Group39").size(), std::size_t{10});
+    EXPECT_LT(manager.metricsReport().historyBytes, steady);
+}
+
+TEST(WeightedSnapshot, StrategyAndBaseWeightsSurviveARestart)
+{
+    TempDir dir;
+    RosterManager live(std::uint64_t{8});
+    ASSERT_TRUE(live.importFromFile(dir.write("roster.csv", rosterCsv(30, 3))));
+    live.setSelectionStrategy(std::make_unique<BaseWeightStrategy>());
+    for (int i = 0; i < 30; ++i)
+    {
+        ASSERT_TRUE(live.setStudentWeight("Student" + std::to_string(i), i == 4 ? 1.0 : 0.0));
+    }
+    ASSERT_TRUE(live.openWal(dir.file("roster.wal"), dir.file("roster.snap")));
+    ASSERT_TRUE(live.setStudentWeight("Student4", 0.0));
+    ASSERT_TRUE(live.setStudentWeight("Student13", 2.5));
+    live.flushWal();
+
+    RosterManager restored(std::uint64_t{0});
+    ASSERT_TRUE(restored.loadSnapshot(dir.file("roster.snap")));
+    ASSERT_TRUE(restored.openWal(dir.file("roster.wal"), dir.file("restored.snap")));
+    for (int i = 0; i < 20; ++i)
+    {
+        EXPECT_EQ(restored.pickWeighted(), restored.findStudent("Student13"));
+    }
+    EXPECT_EQ(restored.pickWeighted("Group0"), std::nullopt);
+}
+
+TEST(WeightedSnapshot, UnnamedStrategyIsTakenFromTheLoadingManager)
+{
+    struct FirstOnly : SelectionStrategy
+    {
+        double weight(int callCount, double baseWeight) const override
+        {
+            return callCount ? 0.0 : baseWeight;
+        }
+    };
+    TempDir dir;
+    RosterManager live(std::uint64_t{8});
+    ASSERT_TRUE(live.importFromFile(dir.write("roster.csv", rosterCsv(6, 2))));
+    live.setSelectionStrategy(std::make_unique<FirstOnly>());
+    ASSERT_TRUE(live.setStudentWeight("Student2", 0.0));
+    ASSERT_TRUE(live.saveSnapshot(dir.file("roster.snap")));
+
+    RosterManager plain(std::uint64_t{0});
+    ASSERT_TRUE(plain.loadSnapshot(dir.file("roster.snap")));
+    EXPECT_EQ(plain.pickWeighted(), std::nullopt);
+
+    RosterManager custom(std::uint64_t{0});
+    custom.setSelectionStrategy(std::make_unique<FirstOnly>());
+    ASSERT_TRUE(custom.loadSnapshot(dir.file("roster.snap")));
+    std::set<std::size_t> picked;
+    for (int i = 0; i < 5; ++i)
+    {
+        picked.insert(custom.pickWeighted().value());
+    }
+    EXPECT_EQ(picked.size(), std::size_t{5});
+    EXPECT_EQ(picked.count(*custom.findStudent("Student2")), std::size_t{0});
+    EXPECT_EQ(custom.pickWeighted(), std::nullopt);
+}
+
+// Serves on a loopback port from its own thread for the test's lifetime.
+class ServerTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        server_.setFileRoot(dir_.file(""));
+        auto &course = server_.course("c");
+        for (int i = 0; i < 10; ++i)
+        {
+            course.addStudent("s" + std::to_string(i), i % 2 ? "odd" : "even");
+        }
+        for (port_ = 20000 + static_cast<std::uint16_t>(::getpid() % 20000); !server_.listen(port_); ++port_)
+        {
+        }
+        thread_ = std::thread([this] { server_.run(stop_); });
+    }
+
+    void TearDown() override
+    {
+        // A connection wakes epoll_wait so the stop flag is seen at once.
+        stop_ = 1;
+        ::close(connectToServer());
+        thread_.join();
+    }
+
+    int connectToServer() const
+    {
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port_);
+        if (::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Sends `request`, shuts down the write side and reads until the server
+    // closes the connection.
+    std::string exchange(const std::string &request) const
+    {
+        const int fd = connectToServer();
+        if (fd < 0)
+        {
+            return "connect failed";
+        }
+        ::send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+        ::shutdown(fd, SHUT_WR);
+        std::string reply;
+        std::array<char, 4096> buffer;
+        for (ssize_t n; (n = ::recv(fd, buffer.data(), buffer.size(), 0)) > 0;)
+        {
+            reply.append(buffer.data(), static_cast<std::size_t>(n));
+        }
+        ::close(fd);
+        return reply;
+    }
+
+    static std::vector<std::string> lines(const std::string &text)
+    {
+        std::vector<std::string> result;
+        for (std::size_t start = 0, end; (end = text.find('\n', start)) != std::string::npos; start = end + 1)
+        {
+            result.push_back(text.substr(start, end - start));
+        }
+        return result;
+    }
+
+    TempDir dir_;
+    RosterServer server_;
+    std::uint16_t port_ = 0;
+    volatile std::sig_atomic_t stop_ = 0;
+    std::thread thread_;
+};
+
+TEST_F(ServerTest, HalfClosedConnectionGetsEveryReply)
+{
+    const auto replies = lines(exchange("PICK\tc\nPICK\tc\todd\nSTATS\tc\t1\n"));
+    ASSERT_EQ(replies.size(), 3u);
+    for (const auto &reply : replies)
+    {
+        EXPECT_EQ(reply.rfind("OK\t", 0), 0u) << reply;
+    }
+}
+
+TEST_F(ServerTest, BatchRejectsBadCounts)
+{
+    const auto replies = lines(exchange("BATCH\tc\t99999999999999999999999\nBATCH\tc\t100000000000000\n"
+                                        "BATCH\tc\t65537\nBATCH\tc\tx\nBATCH\tc\t3\n"));
+    ASSERT_EQ(replies.size(), 5u);
+    for (std::size_t i = 0; i < 4; ++i)
+    {
+        EXPECT_EQ(replies[i], "ERR\tbad count");
+    }
+    EXPECT_EQ(replies[4].rfind("OK\t3\t", 0), 0u) << replies[4];
+}
+
+TEST_F(ServerTest, StopsReadingWhileRepliesPileUp)
+{
+    const int fd = connectToServer();
+    ASSERT_GE(fd, 0);
+    const timeval timeout{1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    std::string requests;
+    for (int i = 0; i < 100; ++i)
+    {
+        requests += "BATCH\tc\t65536\n";
+    }
+    while (requests.size() < (std::size_t{64} << 20))
+    {
+        requests += "PICK\tc\n";
+    }
+
+    // The replies are not read, so once the server stops reading the
+    // requests back up until a send times out.
+    std::size_t sent = 0;
+    while (sent < requests.size())
+    {
+        const auto n = ::send(fd, requests.data() + sent, requests.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            break;
+        }
+        sent += static_cast<std::size_t>(n);
+    }
+    EXPECT_LT(sent, requests.size());
+
+    ::shutdown(fd, SHUT_WR);
+    std::size_t replies = 0;
+    std::array<char, 64 * 1024> buffer;
+    for (ssize_t n; (n = ::recv(fd, buffer.data(), buffer.size(), 0)) > 0;)
+    {
+        replies += static_cast<std::size_t>(std::count(buffer.begin(), buffer.begin() + n, '\n'));
+    }
+    ::close(fd);
+    EXPECT_EQ(replies, static_cast<std::size_t>(std::count(requests.begin(), requests.begin() + sent, '\n')));
+}
+
+TEST_F(ServerTest, ImportAnswersBeforeTheRequestsQueuedBehindIt)
+{
+    dir_.write("more.csv", "x,g1\ny,g2\n");
+    const auto replies = lines(exchange("IMPORT\td\tmore.csv\nPICK\td\tg2\n"));
+    ASSERT_EQ(replies.size(), 2u);
+    EXPECT_EQ(replies[0], "OK\t2\t0\t0");
+    EXPECT_EQ(replies[1], "OK\ty\tg2");
+}
+
+TEST_F(ServerTest, FailedImportLeavesNoCourse)
+{
+    const auto replies = lines(exchange("IMPORT\te\tmissing.csv\nPICK\te\n"));
+    ASSERT_EQ(replies.size(), 2u);
+    EXPECT_EQ(replies[0], "ERR\tcannot open");
+    EXPECT_EQ(replies[1], "ERR\tunknown course");
+}
+
+// Steps `task` the way the server does: a step that cannot move returns,
+// and the next one waits for the wakeup.
+template <typename Result>
+Result driveWith(Wakeup &wakeup, Task<Result> task)
+{
+    while (task.step())
+    {
+        wakeup.wait();
+    }
+    return task.result();
+}
+
+TEST(AsyncJobs, ExportWritesTheSameBytesAsTheSynchronousOne)
+{
+    TempDir dir;
+    RosterManager manager(std::uint64_t{6});
+    ASSERT_TRUE(manager.importFromFile(dir.write("roster.csv", rosterCsv(500, 9))));
+    manager.pickBatch(3000);
+    for (const auto *name : {"history.csv", "history.jsonl", "history.bin"})
+    {
+        const auto format = exportFormatFor(name);
+        ASSERT_TRUE(manager.exportHistory(dir.file(name), format, 2500));
+        const auto expected = TempDir::read(dir.file(name));
+        ASSERT_TRUE(manager.exportHistoryAsync(dir.file("run.out"), format, 2500, 100).run());
+        EXPECT_EQ(TempDir::read(dir.file("run.out")), expected) << name;
+        Wakeup wakeup;
+        ASSERT_TRUE(driveWith(wakeup, manager.exportHistoryAsync(dir.file("driven.out"), format, 2500, 100, &wakeup)));
+        EXPECT_EQ(TempDir::read(dir.file("driven.out")), expected) << name;
+    }
+}
+
+TEST(AsyncJobs, ImportEndsInTheSameStateAsTheSynchronousOne)
+{
+    TempDir dir;
+    auto text = rosterCsv(3000, 11);
+    text += "broken line\nStudent5,Group0\n\n  Spaced , Out  \n";
+    const auto roster = dir.write("roster.csv", text);
+    RosterManager sync(std::uint64_t{12});
+    RosterManager async(std::uint64_t{12});
+    ASSERT_TRUE(sync.addStudent("Early", "Group3"));
+    ASSERT_TRUE(async.addStudent("Early", "Group3"));
+
+    const auto expected = sync.importFromFile(roster);
+    Wakeup wakeup;
+    const auto stats = driveWith(wakeup, async.importFromFileAsync(roster, 1000, &wakeup));
+    ASSERT_TRUE(expected && stats);
+    EXPECT_EQ(stats->added, expected->added);
+    EXPECT_EQ(stats->duplicates, expected->duplicates);
+    EXPECT_EQ(stats->malformed, expected->malformed);
+    EXPECT_EQ(statsOf(async), statsOf(sync));
+    EXPECT_EQ(async.groupCount(), sync.groupCount());
+    EXPECT_EQ(async.pickBatch(500), sync.pickBatch(500));
+    EXPECT_EQ(async.pickBatch(40, "Group7"), sync.pickBatch(40, "Group7"));
+}
+
+TEST(BatchRunner, HistoryAndReportRejectCountsThatAreNotNumbers)
+{
+    BatchRunner runner;
+    ASSERT_TRUE(runner.run("add", "a,g"));
+    EXPECT_FALSE(runner.run("history", "5x"));
+    EXPECT_FALSE(runner.run("report", "ten"));
+    EXPECT_TRUE(runner.run("history", "3"));
+    EXPECT_TRUE(runner.run("history", ""));
+    EXPECT_TRUE(runner.run("report", ""));
+    EXPECT_TRUE(runner.finish());
+}
+
+} // namespace